@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "arena.h"
+#include <string.h>
+
+#define ARENA_ALIGN (2 * sizeof(void *))
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/* regular chunks kept after a reset; one huge render must not pin its
+ * peak memory for as long as the parser lives */
+#define ARENA_KEEP_CHUNKS 4
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+};
+
+#define CHUNK_DATA(c) ((unsigned char *)(c) + ARENA_ROUND(sizeof(struct arena_chunk)))
+
+static struct arena_chunk *
+arena_chunk_new(struct arena *ar, size_t size)
+{
+	struct arena_chunk *chunk;
+
+	if (size > SIZE_MAX - ARENA_ROUND(sizeof(struct arena_chunk)))
+		return NULL;
+
+	chunk = sd_malloc(ar->allocator, ARENA_ROUND(sizeof(struct arena_chunk)) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	return chunk;
+}
+
+void
+redcarpet_arena_init(struct arena *ar, size_t chunk_size, const struct sd_allocator *allocator)
+{
+	ar->head = ar->current = ar->large = NULL;
+	ar->ptr = ar->end = NULL;
+	ar->allocator = allocator;
+
+	if (!chunk_size)
+		chunk_size = 4096;
+
+	ar->chunk_size = ARENA_ROUND(chunk_size);
+}
+
+void *
+redcarpet_arena_alloc(struct arena *ar, size_t size)
+{
+	struct arena_chunk *chunk;
+	void *ret;
+
+	if (size > SIZE_MAX - ARENA_ALIGN)
+		return NULL;
+
+	size = ARENA_ROUND(size ? size : 1);
+
+	if ((size_t)(ar->end - ar->ptr) >= size) {
+		ret = ar->ptr;
+		ar->ptr += size;
+		return ret;
+	}
+
+	/* oversized allocations get a chunk of their own, which
+	 * is not kept around after the arena is reset */
+	if (size > ar->chunk_size / 4) {
+		chunk = arena_chunk_new(ar, size);
+		if (!chunk)
+			return NULL;
+
+		chunk->next = ar->large;
+		ar->large = chunk;
+		return CHUNK_DATA(chunk);
+	}
+
+	/* move on to the next retained chunk, or append a new one */
+	if (ar->current && ar->current->next) {
+		chunk = ar->current->next;
+	} else {
+		chunk = arena_chunk_new(ar, ar->chunk_size);
+		if (!chunk)
+			return NULL;
+
+		if (ar->current)
+			ar->current->next = chunk;
+		else
+			ar->head = chunk;
+	}
+
+	ar->current = chunk;
+	ar->ptr = CHUNK_DATA(chunk) + size;
+	ar->end = CHUNK_DATA(chunk) + chunk->size;
+	return CHUNK_DATA(chunk);
+}
+
+void *
+redcarpet_arena_calloc(struct arena *ar, size_t nmemb, size_t size)
+{
+	void *ret;
+
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+
+	ret = redcarpet_arena_alloc(ar, nmemb * size);
+	if (ret)
+		memset(ret, 0x0, nmemb * size);
+
+	return ret;
+}
+
+static void
+arena_chunk_free_list(struct arena *ar, struct arena_chunk *chunk)
+{
+	struct arena_chunk *next;
+
+	while (chunk) {
+		next = chunk->next;
+		sd_free(ar->allocator, chunk);
+		chunk = next;
+	}
+}
+
+void
+redcarpet_arena_reset(struct arena *ar)
+{
+	struct arena_chunk *chunk = ar->head;
+	int kept = 1;
+
+	arena_chunk_free_list(ar, ar->large);
+	ar->large = NULL;
+
+	while (chunk && kept < ARENA_KEEP_CHUNKS) {
+		chunk = chunk->next;
+		kept++;
+	}
+
+	if (chunk) {
+		arena_chunk_free_list(ar, chunk->next);
+		chunk->next = NULL;
+	}
+
+	ar->current = ar->head;
+	if (ar->head) {
+		ar->ptr = CHUNK_DATA(ar->head);
+		ar->end = CHUNK_DATA(ar->head) + ar->head->size;
+	} else {
+		ar->ptr = ar->end = NULL;
+	}
+}
+
+void
+redcarpet_arena_free(struct arena *ar)
+{
+	if (!ar)
+		return;
+
+	arena_chunk_free_list(ar, ar->large);
+	arena_chunk_free_list(ar, ar->head);
+
+	ar->head = ar->current = ar->large = NULL;
+	ar->ptr = ar->end = NULL;
+}
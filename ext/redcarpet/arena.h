@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef ARENA_H__
+#define ARENA_H__
+
+#include <stdlib.h>
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct arena_chunk;
+
+/* struct arena: bump allocator whose contents are released all at once */
+struct arena {
+	struct arena_chunk *head;	/* retained chunks, reused after a reset */
+	struct arena_chunk *current;
+	struct arena_chunk *large;	/* oversized allocations, freed on reset */
+	unsigned char *ptr;
+	unsigned char *end;
+	size_t chunk_size;
+	const struct sd_allocator *allocator;
+};
+
+void redcarpet_arena_init(struct arena *, size_t, const struct sd_allocator *);
+void *redcarpet_arena_alloc(struct arena *, size_t);
+void *redcarpet_arena_calloc(struct arena *, size_t, size_t);
+void redcarpet_arena_reset(struct arena *);
+void redcarpet_arena_free(struct arena *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,6 +22,7 @@
  */
 
 #define BUFFER_MAX_ALLOC_SIZE (1024 * 1024 * 16) //16mb
+#define BUFFER_MAX_GROW_STEP (1024 * 1024 * 4) //4mb
 #define __USE_MINGW_ANSI_STDIO 1
 
 #include "buffer.h"
@@ -38,6 +39,58 @@
 #	define _buf_vsnprintf vsnprintf
 #endif
 
+static void *
+default_malloc(size_t size, void *opaque)
+{
+	return malloc(size);
+}
+
+static void *
+default_realloc(void *ptr, size_t size, void *opaque)
+{
+	return realloc(ptr, size);
+}
+
+static void
+default_free(void *ptr, void *opaque)
+{
+	free(ptr);
+}
+
+const struct sd_allocator sd_allocator_default = {
+	default_malloc,
+	default_realloc,
+	default_free,
+	NULL
+};
+
+void *
+sd_malloc(const struct sd_allocator *allocator, size_t size)
+{
+	if (!allocator)
+		allocator = &sd_allocator_default;
+
+	return allocator->malloc(size, allocator->opaque);
+}
+
+void *
+sd_realloc(const struct sd_allocator *allocator, void *ptr, size_t size)
+{
+	if (!allocator)
+		allocator = &sd_allocator_default;
+
+	return allocator->realloc(ptr, size, allocator->opaque);
+}
+
+void
+sd_free(const struct sd_allocator *allocator, void *ptr)
+{
+	if (!allocator)
+		allocator = &sd_allocator_default;
+
+	allocator->free(ptr, allocator->opaque);
+}
+
 int
 bufprefix(const struct buf *buf, const char *prefix)
 {
@@ -70,11 +123,26 @@ bufgrow(struct buf *buf, size_t neosz)
 	if (buf->asize >= neosz)
 		return BUF_OK;
 
-	neoasz = buf->asize + buf->unit;
-	while (neoasz < neosz)
-		neoasz += buf->unit;
+	if (buf->growth == BUF_GROW_DOUBLE) {
+		/* amortized doubling; a request larger than one step
+		 * (e.g. an explicit reservation) is honoured, rounded up to unit */
+		size_t step = buf->asize < BUFFER_MAX_GROW_STEP ?
+			buf->asize : BUFFER_MAX_GROW_STEP;
+
+		neoasz = buf->asize + step;
+		if (neoasz < neosz)
+			neoasz = neosz;
+
+		neoasz = ((neoasz + buf->unit - 1) / buf->unit) * buf->unit;
+		if (neoasz > BUFFER_MAX_ALLOC_SIZE)
+			neoasz = neosz;
+	} else {
+		neoasz = buf->asize + buf->unit;
+		while (neoasz < neosz)
+			neoasz += buf->unit;
+	}
 
-	neodata = realloc(buf->data, neoasz);
+	neodata = sd_realloc(buf->allocator, buf->data, neoasz);
 	if (!neodata)
 		return BUF_ENOMEM;
 
@@ -87,14 +155,30 @@ bufgrow(struct buf *buf, size_t neosz)
 /* bufnew: allocation of a new buffer */
 struct buf *
 bufnew(size_t unit)
+{
+	return bufnew_growth(unit, BUF_GROW_UNIT);
+}
+
+/* bufnew_growth: allocation of a new buffer with a reallocation strategy */
+struct buf *
+bufnew_growth(size_t unit, bufgrowth_t growth)
+{
+	return bufnew_allocator(unit, growth, NULL);
+}
+
+/* bufnew_allocator: allocation of a new buffer through the given allocator */
+struct buf *
+bufnew_allocator(size_t unit, bufgrowth_t growth, const struct sd_allocator *allocator)
 {
 	struct buf *ret;
-	ret = malloc(sizeof (struct buf));
+	ret = sd_malloc(allocator, sizeof (struct buf));
 
 	if (ret) {
 		ret->data = 0;
 		ret->size = ret->asize = 0;
 		ret->unit = unit;
+		ret->growth = growth;
+		ret->allocator = allocator;
 	}
 	return ret;
 }
@@ -198,6 +282,6 @@ bufrelease(struct buf *buf)
 	if (!buf)
 		return;
 
-	free(buf->data);
-	free(buf);
+	sd_free(buf->allocator, buf->data);
+	sd_free(buf->allocator, buf);
 }
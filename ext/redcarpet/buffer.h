@@ -42,24 +42,50 @@ typedef enum {
 	BUF_ENOMEM = -1,
 } buferror_t;
 
+/* sd_allocator: memory allocation hooks (NULL means sd_allocator_default) */
+struct sd_allocator {
+	void *(*malloc)(size_t size, void *opaque);
+	void *(*realloc)(void *ptr, size_t size, void *opaque);
+	void (*free)(void *ptr, void *opaque);
+	void *opaque;
+};
+
+/* sd_allocator_default: the C library's malloc, realloc and free */
+extern const struct sd_allocator sd_allocator_default;
+
+/* buf_growth: reallocation strategy used when a buffer runs out of space */
+typedef enum {
+	BUF_GROW_UNIT = 0,	/* add `unit` bytes at a time */
+	BUF_GROW_DOUBLE,	/* double the allocated size, capped per step */
+} bufgrowth_t;
+
 /* struct buf: character array buffer */
 struct buf {
 	uint8_t *data;		/* actual character data */
 	size_t size;	/* size of the string */
 	size_t asize;	/* allocated size (0 = volatile buffer) */
 	size_t unit;	/* reallocation unit size (0 = read-only buffer) */
+	bufgrowth_t growth;	/* reallocation strategy */
+	const struct sd_allocator *allocator;	/* NULL = default allocator */
 };
 
 /* BUFPUTSL: optimized bufputs of a string literal */
 #define BUFPUTSL(output, literal) \
 	bufput(output, literal, sizeof literal - 1)
 
-/* bufgrow: increasing the allocated size to the given value */
+/* bufgrow: increasing the allocated size to at least the given value */
+/*	the size is rounded up to unit, and a doubling buffer may grow past it */
 int bufgrow(struct buf *, size_t);
 
 /* bufnew: allocation of a new buffer */
 struct buf *bufnew(size_t) __attribute__ ((malloc));
 
+/* bufnew_growth: allocation of a new buffer with a reallocation strategy */
+struct buf *bufnew_growth(size_t, bufgrowth_t) __attribute__ ((malloc));
+
+/* bufnew_allocator: allocation of a new buffer through the given allocator */
+struct buf *bufnew_allocator(size_t, bufgrowth_t, const struct sd_allocator *) __attribute__ ((malloc));
+
 /* bufnullterm: NUL-termination of the string array (making a C-string) */
 const char *bufcstr(const struct buf *);
 
@@ -81,6 +107,11 @@ void bufrelease(struct buf *);
 /* bufprintf: formatted printing to a buffer */
 void bufprintf(struct buf *, const char *, ...) __attribute__ ((format (printf, 2, 3)));
 
+/* sd_malloc, sd_realloc, sd_free: allocation through an optional allocator */
+void *sd_malloc(const struct sd_allocator *, size_t);
+void *sd_realloc(const struct sd_allocator *, void *, size_t);
+void sd_free(const struct sd_allocator *, void *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "cache.h"
+#include <string.h>
+
+#define CACHE_BUCKETS 64
+
+struct cache_entry {
+	struct cache_entry *chain;	/* next in the same bucket */
+	struct cache_entry *prev;	/* towards the most recently used */
+	struct cache_entry *next;
+	uint64_t key;
+	size_t text_size;
+	size_t output_size;
+	/* followed by the text, then the output */
+};
+
+#define ENTRY_TEXT(e) ((uint8_t *)((e) + 1))
+#define ENTRY_OUTPUT(e) (ENTRY_TEXT(e) + (e)->text_size)
+#define ENTRY_COST(e) (sizeof(struct cache_entry) + (e)->text_size + (e)->output_size)
+
+struct render_cache *
+redcarpet_cache_new(size_t budget, const struct sd_allocator *allocator)
+{
+	struct render_cache *cache = sd_malloc(allocator, sizeof(struct render_cache));
+
+	if (!cache)
+		return NULL;
+
+	memset(cache, 0x0, sizeof(struct render_cache));
+	cache->buckets = sd_malloc(allocator, CACHE_BUCKETS * sizeof(struct cache_entry *));
+	if (!cache->buckets) {
+		sd_free(allocator, cache);
+		return NULL;
+	}
+
+	memset(cache->buckets, 0x0, CACHE_BUCKETS * sizeof(struct cache_entry *));
+	cache->bucket_count = CACHE_BUCKETS;
+	cache->budget = budget;
+	cache->allocator = allocator;
+	return cache;
+}
+
+static inline uint64_t
+cache_mix(uint64_t h, uint64_t v)
+{
+	h ^= v * 0xff51afd7ed558ccdULL;
+	h = (h << 31) | (h >> 33);
+	return h * 0x9e3779b97f4a7c15ULL;
+}
+
+/* redcarpet_cache_hash • multiplicative hash over 8 bytes at a time; the
+ * text is compared on a hit, so this only needs to spread keys well */
+uint64_t
+redcarpet_cache_hash(const uint8_t *data, size_t size, uint64_t seed)
+{
+	uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ULL), v;
+
+	while (size >= 8) {
+		memcpy(&v, data, 8);
+		h = cache_mix(h, v);
+		data += 8;
+		size -= 8;
+	}
+
+	v = 0;
+	if (size)
+		memcpy(&v, data, size);
+	h = cache_mix(h, v);
+
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void
+cache_unlink(struct render_cache *cache, struct cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+}
+
+static void
+cache_push(struct render_cache *cache, struct cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+
+	if (cache->head)
+		cache->head->prev = entry;
+	else
+		cache->tail = entry;
+	cache->head = entry;
+}
+
+int
+redcarpet_cache_get(struct render_cache *cache, uint64_t key,
+	const uint8_t *text, size_t size, struct buf *ob)
+{
+	struct cache_entry *entry = cache->buckets[key & (cache->bucket_count - 1)];
+
+	for (; entry; entry = entry->chain) {
+		if (entry->key == key && entry->text_size == size &&
+			(!size || memcmp(ENTRY_TEXT(entry), text, size) == 0)) {
+			if (entry != cache->head) {
+				cache_unlink(cache, entry);
+				cache_push(cache, entry);
+			}
+
+			if (entry->output_size)
+				bufput(ob, ENTRY_OUTPUT(entry), entry->output_size);
+			cache->hits++;
+			return 1;
+		}
+	}
+
+	cache->misses++;
+	return 0;
+}
+
+static void
+cache_evict(struct render_cache *cache)
+{
+	struct cache_entry *entry = cache->tail, **link;
+
+	link = &cache->buckets[entry->key & (cache->bucket_count - 1)];
+	while (*link != entry)
+		link = &(*link)->chain;
+	*link = entry->chain;
+
+	cache_unlink(cache, entry);
+	cache->bytes -= ENTRY_COST(entry);
+	cache->entries--;
+	cache->evictions++;
+	sd_free(cache->allocator, entry);
+}
+
+/* cache_grow • doubles the buckets once there are as many entries; the
+ * cache keeps working with longer chains if that fails */
+static void
+cache_grow(struct render_cache *cache)
+{
+	size_t count = cache->bucket_count * 2, i;
+	struct cache_entry **buckets, *entry, *chain;
+
+	buckets = sd_malloc(cache->allocator, count * sizeof(struct cache_entry *));
+	if (!buckets)
+		return;
+
+	memset(buckets, 0x0, count * sizeof(struct cache_entry *));
+
+	for (i = 0; i < cache->bucket_count; ++i) {
+		for (entry = cache->buckets[i]; entry; entry = chain) {
+			chain = entry->chain;
+			entry->chain = buckets[entry->key & (count - 1)];
+			buckets[entry->key & (count - 1)] = entry;
+		}
+	}
+
+	sd_free(cache->allocator, cache->buckets);
+	cache->buckets = buckets;
+	cache->bucket_count = count;
+}
+
+void
+redcarpet_cache_put(struct render_cache *cache, uint64_t key,
+	const uint8_t *text, size_t size, const uint8_t *output, size_t output_size)
+{
+	struct cache_entry *entry, **bucket;
+	size_t cost = sizeof(struct cache_entry) + size + output_size;
+
+	if (cost > cache->budget)
+		return;
+
+	while (cache->bytes + cost > cache->budget)
+		cache_evict(cache);
+
+	if (cache->entries >= cache->bucket_count)
+		cache_grow(cache);
+
+	entry = sd_malloc(cache->allocator, cost);
+	if (!entry)
+		return;
+
+	entry->key = key;
+	entry->text_size = size;
+	entry->output_size = output_size;
+	/* an empty text or output may come without any data */
+	if (size)
+		memcpy(ENTRY_TEXT(entry), text, size);
+	if (output_size)
+		memcpy(ENTRY_OUTPUT(entry), output, output_size);
+
+	bucket = &cache->buckets[key & (cache->bucket_count - 1)];
+	entry->chain = *bucket;
+	*bucket = entry;
+	cache_push(cache, entry);
+
+	cache->bytes += cost;
+	cache->entries++;
+}
+
+void
+redcarpet_cache_free(struct render_cache *cache)
+{
+	struct cache_entry *entry, *next;
+
+	if (!cache)
+		return;
+
+	for (entry = cache->head; entry; entry = next) {
+		next = entry->next;
+		sd_free(cache->allocator, entry);
+	}
+
+	sd_free(cache->allocator, cache->buckets);
+	sd_free(cache->allocator, cache);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef CACHE_H__
+#define CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cache_entry;
+
+/* struct render_cache: rendered documents, keyed by a hash of their text
+ * and evicted least recently used first once over the byte budget */
+struct render_cache {
+	struct cache_entry **buckets;
+	size_t bucket_count;	/* a power of two */
+	struct cache_entry *head;	/* most recently used */
+	struct cache_entry *tail;
+	size_t budget;
+	size_t bytes;	/* entries, with their text and output */
+	size_t entries;
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	const struct sd_allocator *allocator;
+};
+
+/* redcarpet_cache_new: an empty cache holding at most budget bytes */
+struct render_cache *redcarpet_cache_new(size_t, const struct sd_allocator *);
+
+/* redcarpet_cache_hash: the key of a document, for a given seed */
+uint64_t redcarpet_cache_hash(const uint8_t *, size_t, uint64_t);
+
+/* redcarpet_cache_get: appends the output cached for a document to ob,
+ * returns 0 when there is none */
+int redcarpet_cache_get(struct render_cache *, uint64_t, const uint8_t *, size_t, struct buf *);
+
+/* redcarpet_cache_put: remembers the output of a document */
+void redcarpet_cache_put(struct render_cache *, uint64_t, const uint8_t *, size_t, const uint8_t *, size_t);
+
+/* redcarpet_cache_free: release of the cache and every entry */
+void redcarpet_cache_free(struct render_cache *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
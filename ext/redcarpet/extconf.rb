@@ -2,5 +2,8 @@ require 'mkmf'
 
 $CFLAGS << ' -fvisibility=hidden'
 
+have_header('pthread.h')
+have_header('ruby/thread.h')
+
 dir_config('redcarpet')
 create_makefile('redcarpet')
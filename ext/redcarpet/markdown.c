@@ -23,12 +23,20 @@
 
 #include "markdown.h"
 #include "stack.h"
+#include "arena.h"
+#include "scan.h"
+#include "tree.h"
+#include "cache.h"
 
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #if defined(_WIN32)
 #define strncasecmp	_strnicmp
 #endif
@@ -49,19 +57,24 @@
  * LOCAL TYPES *
  ***************/
 
+/* ref_name: name of a link or footnote reference, heading both */
+struct ref_name {
+	unsigned int id;	/* hash of the case-folded name */
+	uint8_t *name;
+	size_t name_size;
+};
+
 /* link_ref: reference to a link */
 struct link_ref {
-	unsigned int id;
+	struct ref_name key;
 
 	struct buf *link;
 	struct buf *title;
-
-	struct link_ref *next;
 };
 
 /* footnote_ref: reference to a footnote */
 struct footnote_ref {
-	unsigned int id;
+	struct ref_name key;
 
 	int is_used;
 	unsigned int num;
@@ -69,6 +82,15 @@ struct footnote_ref {
 	struct buf *contents;
 };
 
+/* ref_table: open-addressing table of references, keyed by their
+ * case-folded name */
+struct ref_table {
+	struct ref_name **slots;
+	size_t size;	/* a power of two, or 0 until the first reference */
+	size_t count;
+	size_t longest;	/* name, so that longer ones aren't even hashed */
+};
+
 /* footnote_item: an item in a footnote_list */
 struct footnote_item {
 	struct footnote_ref *ref;
@@ -137,17 +159,172 @@ static char_trigger markdown_char_ptrs[] = {
 };
 
 /* render • structure containing one particular render */
-struct sd_markdown {
+/* sd_stream: state of a document fed in pieces, see STREAMING */
+struct sd_stream {
+	struct buf *pending;	/* raw input not through the first pass */
+	struct buf *text;	/* first pass output not rendered yet */
+	struct buf *ob;	/* rendered output not handed over yet */
+	int active;
+	int at_start;	/* nothing went through the first pass yet */
+
+	/* raw input */
+	size_t scanned;	/* complete lines already looked at */
+	int raw_blank;	/* whether the last of them was blank */
+	int in_fence;	/* fence state of the first pass */
+	struct buf fence_delim;
+	uint8_t fence_delim_char;
+
+	/* text */
+	size_t tracked;	/* bytes already followed by stream_track */
+	size_t cut;	/* last place the text can be cut at */
+	int prev_blank;
+	uint8_t fence_char;	/* fence opened in the text, if fence_size */
+	size_t fence_size;
+	int fence_lost;	/* no telling where fences are anymore */
+	struct buf *html_open;	/* offsets of HTML blocks waiting for their end */
+	int html_retry;	/* a line that may end one came in */
+};
+
+/* block_span: a top-level block of the last incremental render; it
+ * starts where the previous one ends */
+struct block_span {
+	size_t end;	/* in the text */
+	size_t out_end;	/* in the output */
+	int empty;	/* a blank line */
+};
+
+/* block_index: what an incremental render keeps of the previous one */
+struct block_index {
+	struct buf *text;	/* the text after the first pass */
+	struct buf *output;
+	struct block_span *blocks;
+	size_t count;
+	size_t asize;
+	size_t out_begin;	/* where the output of the first block starts */
+	int empty_start;	/* whether it was rendered into an empty buffer */
+	uint64_t refs;	/* fingerprint of the reference definitions */
+	int valid;
+};
+
+/* struct span_index: what parsing a span of inline markdown learns
+ * about it along the way, so that openers without a closer don't each
+ * go over the rest of the span again.
+ *
+ * The scans for a closing emphasis delimiter, or for the end of a link
+ * title, go from position to position in a way that only depends on
+ * where they are, so another scan reaching a position where one failed
+ * fails too; see find_emph_closer. Code spans look their closer up in
+ * the runs of backticks of the span, and links the end of their text
+ * and destination in its brackets and parentheses; see
+ * find_codespan_closer, find_link_text_end and find_link_dest_end */
+enum span_scan {
+	SCAN_EMPH = 0,	/* single, double and triple, for each of * _ ~ = */
+	SCAN_LINK_TITLE_DQ = 12,	/* in a "title" */
+	SCAN_LINK_TITLE_SQ,	/* in a 'title' */
+	SCAN_LINK_TITLE_END,	/* after it */
+	SPAN_SCANS
+};
+
+struct backtick_run {
+	size_t pos, len;	/* in the span */
+	size_t longer;	/* the next run longer than this one */
+};
+
+struct bracket_pair {
+	size_t open;	/* in the span */
+	size_t close;	/* 0 when there is none */
+	int has_nl;	/* a newline between them */
+};
+
+struct paren {
+	size_t pos;	/* in the span */
+	size_t end;	/* where a destination from here ends, or 0 */
+};
+
+struct span_index {
+	const uint8_t *data, *end;	/* the span */
+	uint8_t *failed[SPAN_SCANS];	/* bitmaps, by distance from the end */
+	size_t failed_size[SPAN_SCANS];	/* in bytes */
+	int failed_used;
+	struct backtick_run *runs;	/* built on the first backtick */
+	size_t run_count, run_cursor;
+	int runs_built;
+	struct bracket_pair *pairs;	/* built on the first link */
+	size_t pair_count, pair_cursor;
+	size_t *closes;	/* every ], escaped or not */
+	size_t close_count;
+	int pairs_built;
+	struct paren *parens;	/* built on the first link destination */
+	size_t paren_count;
+	size_t *quotes;	/* quotes after a space, which end destinations */
+	size_t quote_count;
+	int parens_built;
+};
+
+/* struct tag_index: the closing tags of block HTML in a run of blocks,
+ * so that blocks opening a tag don't each go over the rest of the run
+ * looking for theirs; see htmlblock_end */
+struct close_tag {
+	size_t pos;	/* of the <, in the blocks */
+	size_t end;	/* past the blank lines after it */
+};
+
+struct tag_group {
+	const char *tag;	/* as find_block_tag gives it */
+	size_t first, count;	/* in closes... */
+	size_t bol_first, bol_count;	/* ...and in bol */
+};
+
+struct tag_index {
+	uint8_t *data, *end;	/* the blocks */
+	struct tag_group *groups;
+	size_t group_count;
+	struct close_tag *closes;	/* grouped by tag, in order */
+	struct close_tag *bol;	/* the same, for those starting a line */
+	int built;	/* -1 when out of memory */
+};
+
+/* struct sd_parser: what a parser is configured with. It is built by
+ * sd_markdown_new and never changes afterwards, so that the parsers
+ * forked from it can share it between threads */
+struct sd_parser {
 	struct sd_callbacks	cb;
+	uint8_t active_char[256];
+	struct scanner scanner;	/* finds the next active_char */
+	struct scanner line_scanner;	/* finds the next line end or tab */
+	unsigned int ext_flags;
+	size_t max_nesting;
+};
+
+/* struct sd_markdown: a parser, holding the state of a render */
+struct sd_markdown {
+	const struct sd_parser *parser;
+	int owns_parser;	/* built by sd_markdown_new, not forked */
 	void *opaque;
 
-	struct link_ref *refs[REF_TABLE_SIZE];
-	struct footnote_list footnotes_found;
+	struct ref_table refs;
+	struct ref_table footnotes_found;
 	struct footnote_list footnotes_used;
-	uint8_t active_char[256];
 	struct stack work_bufs[2];
-	unsigned int ext_flags;
-	size_t max_nesting;
+	struct arena arena;
+	const struct sd_allocator *allocator;
+	struct sd_stream stream;
+	struct rope *sink;	/* when rendering to a rope... */
+	struct buf *sink_ob;	/* ...the top-level output flushed into it */
+	const uint8_t *borrowed;	/* the caller's document, when parsed in place... */
+	size_t borrowed_size;
+	struct buf *borrowed_work;	/* ...and where its quotes and list items get compacted */
+	struct sd_tree *tree;	/* the tree being built by sd_markdown_parse */
+	const struct sd_parser *tree_parser;	/* ...and the parser its recorder stands in for */
+	struct render_cache *cache;	/* see sd_markdown_cache */
+	uint64_t cache_seed;
+	struct block_index *index;	/* see sd_markdown_render_incremental */
+	unsigned int threads;	/* see sd_markdown_parallel */
+	size_t budget;	/* see sd_markdown_budget */
+	size_t work_left;	/* of the budget, in the current render */
+	int truncated;	/* the budget ran out */
+	struct span_index *span;	/* of the span being parsed */
+	struct tag_index *tags;	/* of the blocks being parsed */
 	int in_link_body;
 };
 
@@ -167,19 +344,84 @@ rndr_newbuf(struct sd_markdown *rndr, int type)
 		work = pool->item[pool->size++];
 		work->size = 0;
 	} else {
-		work = bufnew(buf_size[type]);
+		work = bufnew_allocator(buf_size[type], BUF_GROW_DOUBLE, rndr->allocator);
 		redcarpet_stack_push(pool, work);
 	}
 
 	return work;
 }
 
+/* rndr_workbuf • the buffer a blockquote or list item starting at data
+ * has to be compacted into, or NULL when it can be compacted in place;
+ * the caller's document is never written to */
+static inline struct buf *
+rndr_workbuf(struct sd_markdown *rndr, const uint8_t *data)
+{
+	if (rndr->borrowed && data >= rndr->borrowed &&
+		data < rndr->borrowed + rndr->borrowed_size) {
+		rndr->borrowed_work->size = 0;
+		return rndr->borrowed_work;
+	}
+
+	return NULL;
+}
+
+/* rndr_rewind • takes back the last size bytes of text written to ob */
+static inline void
+rndr_rewind(struct sd_markdown *rndr, struct buf *ob, size_t size)
+{
+	if (rndr->tree)
+		redcarpet_tree_rewind(rndr->tree, ob, size);
+	else
+		ob->size -= size;
+}
+
+/* rndr_last_char • the last byte written to ob, or -1 */
+static inline int
+rndr_last_char(struct sd_markdown *rndr, const struct buf *ob)
+{
+	if (rndr->tree)
+		return redcarpet_tree_last_char(rndr->tree, ob);
+
+	return ob->size ? ob->data[ob->size - 1] : -1;
+}
+
 static inline void
 rndr_popbuf(struct sd_markdown *rndr, int type)
 {
 	rndr->work_bufs[type].size--;
 }
 
+/* rndr_spend • takes work units out of the budget, returning 0 when
+ * there aren't that many left */
+static inline int
+rndr_spend(struct sd_markdown *rndr, size_t work)
+{
+	if (!rndr->budget)
+		return 1;
+
+	if (rndr->work_left < work) {
+		rndr->work_left = 0;
+		rndr->truncated = 1;
+		return 0;
+	}
+
+	rndr->work_left -= work;
+	return 1;
+}
+
+/* rndr_plain • outputs text as it is, but for escaping */
+static void
+rndr_plain(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	struct buf work = { data, size, 0, 0, BUF_GROW_UNIT, NULL };
+
+	if (rndr->parser->cb.normal_text)
+		rndr->parser->cb.normal_text(ob, &work, rndr->opaque);
+	else
+		bufput(ob, data, size);
+}
+
 static void
 unscape_text(struct buf *ob, struct buf *src)
 {
@@ -212,76 +454,156 @@ hash_link_ref(const uint8_t *link_ref, size_t length)
 	return hash;
 }
 
-static struct link_ref *
-add_link_ref(
-	struct link_ref **references,
-	const uint8_t *name, size_t name_size)
+/* arena_bufdup • copies data into a read-only buffer allocated from the arena */
+static struct buf *
+arena_bufdup(struct arena *arena, const uint8_t *data, size_t size)
 {
-	struct link_ref *ref = calloc(1, sizeof(struct link_ref));
+	struct buf *buf = redcarpet_arena_alloc(arena, sizeof(struct buf) + size);
 
-	if (!ref)
+	if (!buf)
 		return NULL;
 
-	ref->id = hash_link_ref(name, name_size);
-	ref->next = references[ref->id % REF_TABLE_SIZE];
+	buf->data = (uint8_t *)(buf + 1);
+	buf->size = size;
+	buf->asize = 0;
+	buf->unit = 0;
+	buf->growth = BUF_GROW_UNIT;
 
-	references[ref->id % REF_TABLE_SIZE] = ref;
-	return ref;
+	memcpy(buf->data, data, size);
+	return buf;
 }
 
-static struct link_ref *
-find_link_ref(struct link_ref **references, uint8_t *name, size_t length)
+/* ref_table_slot • the slot holding the reference called name, or the
+ * empty slot it would go into */
+static struct ref_name **
+ref_table_slot(struct ref_table *table, unsigned int hash, const uint8_t *name, size_t length)
 {
-	unsigned int hash = hash_link_ref(name, length);
-	struct link_ref *ref = NULL;
-
-	ref = references[hash % REF_TABLE_SIZE];
+	size_t mask = table->size - 1, i = hash & mask, j;
+	struct ref_name *key;
 
-	while (ref != NULL) {
-		if (ref->id == hash)
-			return ref;
+	while ((key = table->slots[i]) != NULL) {
+		if (key->id == hash && key->name_size == length) {
+			for (j = 0; j < length && tolower(key->name[j]) == tolower(name[j]); ++j);
+			if (j == length)
+				break;
+		}
 
-		ref = ref->next;
+		i = (i + 1) & mask;
 	}
 
-	return NULL;
+	return &table->slots[i];
 }
 
-static void
-free_link_refs(struct link_ref **references)
+/* ref_table_grow • doubles the number of slots, keeping them at most
+ * half full; the old slots stay in the arena until the end of the render */
+static int
+ref_table_grow(struct arena *arena, struct ref_table *table)
 {
+	struct ref_table grown;
 	size_t i;
 
-	for (i = 0; i < REF_TABLE_SIZE; ++i) {
-		struct link_ref *r = references[i];
-		struct link_ref *next;
+	grown.size = table->size ? table->size * 2 : REF_TABLE_SIZE;
+	grown.count = table->count;
+	grown.longest = table->longest;
+	grown.slots = redcarpet_arena_calloc(arena, grown.size, sizeof(struct ref_name *));
 
-		while (r) {
-			next = r->next;
-			bufrelease(r->link);
-			bufrelease(r->title);
-			free(r);
-			r = next;
-		}
+	if (!grown.slots)
+		return 0;
+
+	for (i = 0; i < table->size; ++i) {
+		struct ref_name *key = table->slots[i];
+
+		if (key)
+			*ref_table_slot(&grown, key->id, key->name, key->name_size) = key;
 	}
+
+	*table = grown;
+	return 1;
 }
 
-static struct footnote_ref *
-create_footnote_ref(struct footnote_list *list, const uint8_t *name, size_t name_size)
+/* ref_table_add • names a new reference and files it in the table; when
+ * the name is already taken, the reference replaces the one there only
+ * if replace is set */
+static int
+ref_table_add(
+	struct arena *arena,
+	struct ref_table *table,
+	struct ref_name *key,
+	const uint8_t *name, size_t name_size,
+	int replace)
+{
+	struct ref_name **slot;
+
+	if (table->count * 2 >= table->size && !ref_table_grow(arena, table))
+		return 0;
+
+	key->name = redcarpet_arena_alloc(arena, name_size ? name_size : 1);
+	if (!key->name)
+		return 0;
+
+	memcpy(key->name, name, name_size);
+	key->name_size = name_size;
+	key->id = hash_link_ref(name, name_size);
+
+	slot = ref_table_slot(table, key->id, name, name_size);
+	if (!*slot)
+		table->count++;
+	else if (!replace)
+		return 1;
+
+	if (name_size > table->longest)
+		table->longest = name_size;
+
+	*slot = key;
+	return 1;
+}
+
+static struct ref_name *
+ref_table_find(struct ref_table *table, const uint8_t *name, size_t length)
+{
+	if (!table->size || length > table->longest)
+		return NULL;
+
+	return *ref_table_slot(table, hash_link_ref(name, length), name, length);
+}
+
+static struct link_ref *
+add_link_ref(
+	struct arena *arena,
+	struct ref_table *references,
+	const uint8_t *name, size_t name_size)
 {
-	struct footnote_ref *ref = calloc(1, sizeof(struct footnote_ref));
-	if (!ref)
+	struct link_ref *ref = redcarpet_arena_calloc(arena, 1, sizeof(struct link_ref));
+
+	/* a later definition of the same name takes its place */
+	if (!ref || !ref_table_add(arena, references, &ref->key, name, name_size, 1))
 		return NULL;
 
-	ref->id = hash_link_ref(name, name_size);
+	return ref;
+}
+
+static struct link_ref *
+find_link_ref(struct ref_table *references, uint8_t *name, size_t length)
+{
+	return (struct link_ref *)ref_table_find(references, name, length);
+}
+
+static struct footnote_ref *
+create_footnote_ref(struct arena *arena, struct ref_table *footnotes, const uint8_t *name, size_t name_size)
+{
+	struct footnote_ref *ref = redcarpet_arena_calloc(arena, 1, sizeof(struct footnote_ref));
+
+	/* the first definition of a name is the one kept */
+	if (!ref || !ref_table_add(arena, footnotes, &ref->key, name, name_size, 0))
+		return NULL;
 
 	return ref;
 }
 
 static int
-add_footnote_ref(struct footnote_list *list, struct footnote_ref *ref)
+add_footnote_ref(struct arena *arena, struct footnote_list *list, struct footnote_ref *ref)
 {
-	struct footnote_item *item = calloc(1, sizeof(struct footnote_item));
+	struct footnote_item *item = redcarpet_arena_calloc(arena, 1, sizeof(struct footnote_item));
 	if (!item)
 		return 0;
 	item->ref = ref;
@@ -298,42 +620,9 @@ add_footnote_ref(struct footnote_list *list, struct footnote_ref *ref)
 }
 
 static struct footnote_ref *
-find_footnote_ref(struct footnote_list *list, uint8_t *name, size_t length)
-{
-	unsigned int hash = hash_link_ref(name, length);
-	struct footnote_item *item = NULL;
-
-	item = list->head;
-
-	while (item != NULL) {
-		if (item->ref->id == hash)
-			return item->ref;
-		item = item->next;
-	}
-
-	return NULL;
-}
-
-static void
-free_footnote_ref(struct footnote_ref *ref)
-{
-	bufrelease(ref->contents);
-	free(ref);
-}
-
-static void
-free_footnote_list(struct footnote_list *list, int free_refs)
+find_footnote_ref(struct ref_table *footnotes, uint8_t *name, size_t length)
 {
-	struct footnote_item *item = list->head;
-	struct footnote_item *next;
-
-	while (item) {
-		next = item->next;
-		if (free_refs)
-			free_footnote_ref(item->ref);
-		free(item);
-		item = next;
-	}
+	return (struct footnote_ref *)ref_table_find(footnotes, name, length);
 }
 
 /*
@@ -466,22 +755,36 @@ parse_inline(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t siz
 {
 	size_t i = 0, end = 0, consumed = 0;
 	uint8_t action = 0;
-	struct buf work = { 0, 0, 0, 0 };
+	struct buf work = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
+	struct span_index span, *outer = rndr->span;
 
 	if (rndr->work_bufs[BUFFER_SPAN].size +
-		rndr->work_bufs[BUFFER_BLOCK].size > rndr->max_nesting)
+		rndr->work_bufs[BUFFER_BLOCK].size > rndr->parser->max_nesting)
+		return;
+
+	if (!rndr_spend(rndr, size)) {
+		rndr_plain(ob, rndr, data, size);
 		return;
+	}
+
+	span.data = data;
+	span.end = data + size;
+	span.failed_used = 0;
+	span.runs_built = 0;
+	span.pairs_built = 0;
+	span.parens_built = 0;
+	rndr->span = &span;
 
 	while (i < size) {
 		/* copying inactive chars into the output */
-		while (end < size && (action = rndr->active_char[data[end]]) == 0) {
-			end++;
-		}
+		end += redcarpet_scanner_find(&rndr->parser->scanner, data + end, size - end);
+		if (end < size)
+			action = rndr->parser->active_char[data[end]];
 
-		if (rndr->cb.normal_text) {
+		if (rndr->parser->cb.normal_text) {
 			work.data = data + i;
 			work.size = end - i;
-			rndr->cb.normal_text(ob, &work, rndr->opaque);
+			rndr->parser->cb.normal_text(ob, &work, rndr->opaque);
 		}
 		else
 			bufput(ob, data + i, end - i);
@@ -489,15 +792,42 @@ parse_inline(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t siz
 		if (end >= size) break;
 		i = end;
 
+		if (!rndr_spend(rndr, 1)) {
+			rndr_plain(ob, rndr, data + i, size - i);
+			break;
+		}
+
 		end = markdown_char_ptrs[(int)action](ob, rndr, data + i, i - consumed, size - i);
 		if (!end) /* no action from the callback */
 			end = i + 1;
 		else {
+			if (rndr->tree)
+				redcarpet_tree_span(rndr->tree, ob, data + i, end);
+
 			i += end;
 			end = i;
 			consumed = i;
 		}
 	}
+
+	if (span.failed_used)
+		for (i = 0; i < SPAN_SCANS; ++i)
+			sd_free(rndr->allocator, span.failed[i]);
+
+	if (span.runs_built)
+		sd_free(rndr->allocator, span.runs);
+
+	if (span.pairs_built) {
+		sd_free(rndr->allocator, span.pairs);
+		sd_free(rndr->allocator, span.closes);
+	}
+
+	if (span.parens_built) {
+		sd_free(rndr->allocator, span.parens);
+		sd_free(rndr->allocator, span.quotes);
+	}
+
+	rndr->span = outer;
 }
 
 /* find_emph_char • looks for the next emph uint8_t, skipping other constructs */
@@ -591,77 +921,178 @@ find_emph_char(uint8_t *data, size_t size, uint8_t c)
 	return 0;
 }
 
-/* parse_emph1 • parsing single emphase */
-/* closed by a symbol not preceded by whitespace and not followed by symbol */
-static size_t
-parse_emph1(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, uint8_t c)
+enum emph_scan {
+	EMPH_SINGLE,
+	EMPH_DOUBLE,
+	EMPH_TRIPLE
+};
+
+/* scan_failed_bit • the bitmap and bit of a position of the span */
+static inline uint8_t *
+scan_failed_bit(struct span_index *span, const uint8_t *at, int scan, uint8_t *mask)
 {
-	size_t i = 0, len;
-	struct buf *work = 0;
-	int r;
+	size_t dist = span->end - at;
 
-	/* skipping one symbol if coming from emph3 */
-	if (size > 1 && data[0] == c && data[1] == c) i = 1;
+	*mask = 1 << (dist & 7);
+	if (!span->failed_used || (dist >> 3) >= span->failed_size[scan])
+		return NULL;
+
+	return &span->failed[scan][dist >> 3];
+}
+
+/* scan_failed_grow • makes room in the bitmap of a scan for the
+ * positions from at to the end of the span */
+static int
+scan_failed_grow(struct sd_markdown *rndr, const uint8_t *at, int scan)
+{
+	struct span_index *span = rndr->span;
+	size_t size = ((span->end - at) >> 3) + 1;
+	uint8_t *failed;
+
+	if (!span->failed_used) {
+		memset(span->failed, 0x0, sizeof(span->failed));
+		memset(span->failed_size, 0x0, sizeof(span->failed_size));
+		span->failed_used = 1;
+	}
+
+	if (size <= span->failed_size[scan])
+		return 1;
+
+	failed = sd_realloc(rndr->allocator, span->failed[scan], size);
+	if (!failed)
+		return 0;
+
+	memset(failed + span->failed_size[scan], 0x0, size - span->failed_size[scan]);
+	span->failed[scan] = failed;
+	span->failed_size[scan] = size;
+	return 1;
+}
+
+/* scan_emph_closer • follows the scan of a parse_emph function from i
+ * to the delimiter closing its emphasis, or returns 0; when marking,
+ * records every position it goes through as failed */
+static size_t
+scan_emph_closer(struct sd_markdown *rndr, uint8_t *data, size_t size, size_t i, uint8_t c,
+	enum emph_scan kind, int scan, int marking)
+{
+	uint8_t *bits, mask;
+	size_t len;
 
 	while (i < size) {
+		bits = scan_failed_bit(rndr->span, data + i, scan, &mask);
+		if (bits && (*bits & mask))
+			return 0;
+		if (marking && bits)
+			*bits |= mask;
+
 		len = find_emph_char(data + i, size - i, c);
 		if (!len) return 0;
 		i += len;
 		if (i >= size) return 0;
 
-		if (data[i] == c && !_isspace(data[i - 1])) {
-
-			if (rndr->ext_flags & MKDEXT_NO_INTRA_EMPHASIS) {
-				if (i + 1 < size && _isalnum(data[i + 1]))
-					continue;
+		switch (kind) {
+		case EMPH_SINGLE:
+			/* closed by a symbol not preceded by whitespace and not followed by symbol */
+			if (data[i] == c && !_isspace(data[i - 1])) {
+				if ((rndr->parser->ext_flags & MKDEXT_NO_INTRA_EMPHASIS) &&
+					i + 1 < size && _isalnum(data[i + 1]))
+					break;
+				return i;
 			}
+			break;
 
-			work = rndr_newbuf(rndr, BUFFER_SPAN);
-			parse_inline(work, rndr, data, i);
-
-			if (rndr->ext_flags & MKDEXT_UNDERLINE && c == '_')
-				r = rndr->cb.underline(ob, work, rndr->opaque);
-			else
-				r = rndr->cb.emphasis(ob, work, rndr->opaque);
+		case EMPH_DOUBLE:
+			if (i + 1 < size && data[i] == c && data[i + 1] == c && i && !_isspace(data[i - 1]))
+				return i;
+			i++;
+			break;
 
-			rndr_popbuf(rndr, BUFFER_SPAN);
-			return r ? i + 1 : 0;
+		case EMPH_TRIPLE:
+			/* skip whitespace preceded symbols */
+			if (data[i] == c && !_isspace(data[i - 1]))
+				return i;
+			break;
 		}
 	}
 
 	return 0;
 }
 
+/* find_emph_closer • the delimiter closing an emphasis of the given
+ * kind whose content starts at i, or 0. Openers without a closer would
+ * each scan the rest of the span, so failed scans are remembered */
+static size_t
+find_emph_closer(struct sd_markdown *rndr, uint8_t *data, size_t size, size_t i, uint8_t c, enum emph_scan kind)
+{
+	size_t closer;
+	int scan;
+
+	switch (c) {
+	case '*': scan = 0; break;
+	case '_': scan = 1; break;
+	case '~': scan = 2; break;
+	default: scan = 3; break;
+	}
+	scan = SCAN_EMPH + scan * 3 + kind;
+
+	closer = scan_emph_closer(rndr, data, size, i, c, kind, scan, 0);
+	if (!closer && i < size && scan_failed_grow(rndr, data + i, scan))
+		scan_emph_closer(rndr, data, size, i, c, kind, scan, 1);
+
+	return closer;
+}
+
+/* parse_emph1 • parsing single emphase */
+static size_t
+parse_emph1(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, uint8_t c)
+{
+	size_t i = 0;
+	struct buf *work = 0;
+	int r;
+
+	/* skipping one symbol if coming from emph3 */
+	if (size > 1 && data[0] == c && data[1] == c) i = 1;
+
+	i = find_emph_closer(rndr, data, size, i, c, EMPH_SINGLE);
+	if (!i)
+		return 0;
+
+	work = rndr_newbuf(rndr, BUFFER_SPAN);
+	parse_inline(work, rndr, data, i);
+
+	if (rndr->parser->ext_flags & MKDEXT_UNDERLINE && c == '_')
+		r = rndr->parser->cb.underline(ob, work, rndr->opaque);
+	else
+		r = rndr->parser->cb.emphasis(ob, work, rndr->opaque);
+
+	rndr_popbuf(rndr, BUFFER_SPAN);
+	return r ? i + 1 : 0;
+}
+
 /* parse_emph2 • parsing single emphase */
 static size_t
 parse_emph2(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, uint8_t c)
 {
-	size_t i = 0, len;
+	size_t i;
 	struct buf *work = 0;
 	int r;
 
-	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
-		if (!len) return 0;
-		i += len;
+	i = find_emph_closer(rndr, data, size, 0, c, EMPH_DOUBLE);
+	if (!i)
+		return 0;
 
-		if (i + 1 < size && data[i] == c && data[i + 1] == c && i && !_isspace(data[i - 1])) {
-			work = rndr_newbuf(rndr, BUFFER_SPAN);
-			parse_inline(work, rndr, data, i);
+	work = rndr_newbuf(rndr, BUFFER_SPAN);
+	parse_inline(work, rndr, data, i);
 
-			if (c == '~')
-				r = rndr->cb.strikethrough(ob, work, rndr->opaque);
-			else if (c == '=')
-				r = rndr->cb.highlight(ob, work, rndr->opaque);
-			else
-				r = rndr->cb.double_emphasis(ob, work, rndr->opaque);
+	if (c == '~')
+		r = rndr->parser->cb.strikethrough(ob, work, rndr->opaque);
+	else if (c == '=')
+		r = rndr->parser->cb.highlight(ob, work, rndr->opaque);
+	else
+		r = rndr->parser->cb.double_emphasis(ob, work, rndr->opaque);
 
-			rndr_popbuf(rndr, BUFFER_SPAN);
-			return r ? i + 2 : 0;
-		}
-		i++;
-	}
-	return 0;
+	rndr_popbuf(rndr, BUFFER_SPAN);
+	return r ? i + 2 : 0;
 }
 
 /* parse_emph3 • parsing single emphase */
@@ -669,41 +1100,34 @@ parse_emph2(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 static size_t
 parse_emph3(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, uint8_t c)
 {
-	size_t i = 0, len;
+	size_t i, len;
 	int r;
 
-	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
-		if (!len) return 0;
-		i += len;
-
-		/* skip whitespace preceded symbols */
-		if (data[i] != c || _isspace(data[i - 1]))
-			continue;
+	i = find_emph_closer(rndr, data, size, 0, c, EMPH_TRIPLE);
+	if (!i)
+		return 0;
 
-		if (i + 2 < size && data[i + 1] == c && data[i + 2] == c && rndr->cb.triple_emphasis) {
-			/* triple symbol found */
-			struct buf *work = rndr_newbuf(rndr, BUFFER_SPAN);
+	if (i + 2 < size && data[i + 1] == c && data[i + 2] == c && rndr->parser->cb.triple_emphasis) {
+		/* triple symbol found */
+		struct buf *work = rndr_newbuf(rndr, BUFFER_SPAN);
 
-			parse_inline(work, rndr, data, i);
-			r = rndr->cb.triple_emphasis(ob, work, rndr->opaque);
-			rndr_popbuf(rndr, BUFFER_SPAN);
-			return r ? i + 3 : 0;
+		parse_inline(work, rndr, data, i);
+		r = rndr->parser->cb.triple_emphasis(ob, work, rndr->opaque);
+		rndr_popbuf(rndr, BUFFER_SPAN);
+		return r ? i + 3 : 0;
 
-		} else if (i + 1 < size && data[i + 1] == c) {
-			/* double symbol found, handing over to emph1 */
-			len = parse_emph1(ob, rndr, data - 2, size + 2, c);
-			if (!len) return 0;
-			else return len - 2;
+	} else if (i + 1 < size && data[i + 1] == c) {
+		/* double symbol found, handing over to emph1 */
+		len = parse_emph1(ob, rndr, data - 2, size + 2, c);
+		if (!len) return 0;
+		else return len - 2;
 
-		} else {
-			/* single symbol found, handing over to emph2 */
-			len = parse_emph2(ob, rndr, data - 1, size + 1, c);
-			if (!len) return 0;
-			else return len - 1;
-		}
+	} else {
+		/* single symbol found, handing over to emph2 */
+		len = parse_emph2(ob, rndr, data - 1, size + 1, c);
+		if (!len) return 0;
+		else return len - 1;
 	}
-	return 0;
 }
 
 /* char_emphasis • single and double emphasis parsing */
@@ -713,7 +1137,7 @@ char_emphasis(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t of
 	uint8_t c = data[0];
 	size_t ret;
 
-	if (rndr->ext_flags & MKDEXT_NO_INTRA_EMPHASIS) {
+	if (rndr->parser->ext_flags & MKDEXT_NO_INTRA_EMPHASIS) {
 		if (offset > 0 && _isalnum(data[-1]))
 			return 0;
 	}
@@ -753,31 +1177,109 @@ char_linebreak(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t o
 		return 0;
 
 	/* removing the last space from ob and rendering */
-	while (ob->size && ob->data[ob->size - 1] == ' ')
-		ob->size--;
+	while (rndr_last_char(rndr, ob) == ' ')
+		rndr_rewind(rndr, ob, 1);
 
-	return rndr->cb.linebreak(ob, rndr->opaque) ? 1 : 0;
+	return rndr->parser->cb.linebreak(ob, rndr->opaque) ? 1 : 0;
 }
 
 
-/* char_codespan • '`' parsing a code span (assuming codespan != 0) */
-static size_t
-char_codespan(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset, size_t size)
+/* index_backtick_runs • lists the runs of backticks of the span */
+static int
+index_backtick_runs(struct sd_markdown *rndr, struct span_index *span)
 {
-	size_t end, nb = 0, i, f_begin, f_end;
+	const uint8_t *data = span->data, *p;
+	size_t size = span->end - span->data, i = 0, asize = 0, j, k;
+	struct backtick_run *runs = NULL, *grown;
+
+	span->runs = NULL;
+	span->run_count = 0;
+	span->run_cursor = 0;
+
+	while (i < size && (p = memchr(data + i, '`', size - i)) != NULL) {
+		if (span->run_count == asize) {
+			asize = asize ? asize * 2 : 16;
+			grown = sd_realloc(rndr->allocator, runs, asize * sizeof(struct backtick_run));
+			if (!grown) {
+				sd_free(rndr->allocator, runs);
+				return 0;
+			}
+			runs = grown;
+		}
 
-	/* counting the number of backticks in the delimiter */
-	while (nb < size && data[nb] == '`')
-		nb++;
+		i = p - data;
+		runs[span->run_count].pos = i;
+		while (i < size && data[i] == '`')
+			i++;
+		runs[span->run_count].len = i - runs[span->run_count].pos;
+		span->run_count++;
+	}
+
+	/* following the links of shorter runs, each is followed once */
+	for (j = span->run_count; j-- > 0; ) {
+		k = j + 1;
+		while (k < span->run_count && runs[k].len <= runs[j].len)
+			k = runs[k].longer;
+		runs[j].longer = k;
+	}
+
+	span->runs = runs;
+	span->runs_built = 1;
+	return 1;
+}
+
+/* find_codespan_closer • the end of the first run of at least as many
+ * backticks as open a code span at data (nb of them), or 0 */
+static size_t
+find_codespan_closer(struct sd_markdown *rndr, uint8_t *data, size_t size, size_t *nb)
+{
+	struct span_index *span = rndr->span;
+	size_t end, i, pos, run;
+
+	if (span && span->end == data + size &&
+		(span->runs_built || index_backtick_runs(rndr, span))) {
+		pos = data - span->data;
+
+		/* code spans are opened from the start of the span onwards */
+		if (span->run_cursor < span->run_count && span->runs[span->run_cursor].pos > pos)
+			span->run_cursor = 0;
+		while (span->run_cursor < span->run_count &&
+			span->runs[span->run_cursor].pos + span->runs[span->run_cursor].len <= pos)
+			span->run_cursor++;
+
+		run = span->run_cursor;
+		*nb = span->runs[run].pos + span->runs[run].len - pos;
+
+		run++;
+		while (run < span->run_count && span->runs[run].len < *nb)
+			run = span->runs[run].longer;
+
+		return run < span->run_count ? span->runs[run].pos + *nb - pos : 0;
+	}
+
+	*nb = 0;
+	while (*nb < size && data[*nb] == '`')
+		(*nb)++;
 
-	/* finding the next delimiter */
 	i = 0;
-	for (end = nb; end < size && i < nb; end++) {
+	for (end = *nb; end < size && i < *nb; end++) {
 		if (data[end] == '`') i++;
 		else i = 0;
 	}
 
-	if (i < nb && end >= size)
+	return i < *nb ? 0 : end;
+}
+
+/* char_codespan • '`' parsing a code span (assuming codespan != 0) */
+static size_t
+char_codespan(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset, size_t size)
+{
+	size_t end, nb, f_begin, f_end;
+
+	/* counting the number of backticks in the delimiter, and finding
+	 * the next delimiter */
+	end = find_codespan_closer(rndr, data, size, &nb);
+	if (!end)
 		return 0; /* no matching delimiter */
 
 	/* trimming outside whitespaces */
@@ -791,11 +1293,11 @@ char_codespan(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t of
 
 	/* real code span */
 	if (f_begin < f_end) {
-		struct buf work = { data + f_begin, f_end - f_begin, 0, 0 };
-		if (!rndr->cb.codespan(ob, &work, rndr->opaque))
+		struct buf work = { data + f_begin, f_end - f_begin, 0, 0, BUF_GROW_UNIT, NULL };
+		if (!rndr->parser->cb.codespan(ob, &work, rndr->opaque))
 			end = 0;
 	} else {
-		if (!rndr->cb.codespan(ob, 0, rndr->opaque))
+		if (!rndr->parser->cb.codespan(ob, 0, rndr->opaque))
 			end = 0;
 	}
 
@@ -833,11 +1335,11 @@ char_quote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offse
 
 	/* real quote */
 	if (f_begin < f_end) {
-		struct buf work = { data + f_begin, f_end - f_begin, 0, 0 };
-		if (!rndr->cb.quote(ob, &work, rndr->opaque))
+		struct buf work = { data + f_begin, f_end - f_begin, 0, 0, BUF_GROW_UNIT, NULL };
+		if (!rndr->parser->cb.quote(ob, &work, rndr->opaque))
 			end = 0;
 	} else {
-		if (!rndr->cb.quote(ob, 0, rndr->opaque))
+		if (!rndr->parser->cb.quote(ob, 0, rndr->opaque))
 			end = 0;
 	}
 
@@ -849,20 +1351,25 @@ static size_t
 char_escape(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset, size_t size)
 {
 	static const char *escape_chars = "\\`*_{}[]()#+-.!:|&<>^~=";
-	struct buf work = { 0, 0, 0, 0 };
+	struct buf work = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
 
 	if (size > 1) {
 		if (strchr(escape_chars, data[1]) == NULL)
 			return 0;
 
-		if (rndr->cb.normal_text) {
+		if (rndr->parser->cb.normal_text) {
 			work.data = data + 1;
 			work.size = 1;
-			rndr->cb.normal_text(ob, &work, rndr->opaque);
+			rndr->parser->cb.normal_text(ob, &work, rndr->opaque);
 		}
 		else bufputc(ob, data[1]);
 	} else if (size == 1) {
-		bufputc(ob, data[0]);
+		if (rndr->tree) {
+			work.data = data;
+			work.size = 1;
+			rndr->parser->cb.normal_text(ob, &work, rndr->opaque);
+		}
+		else bufputc(ob, data[0]);
 	}
 
 	return 2;
@@ -874,7 +1381,7 @@ static size_t
 char_entity(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset, size_t size)
 {
 	size_t end = 1;
-	struct buf work = { 0, 0, 0, 0 };
+	struct buf work = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
 
 	if (end < size && data[end] == '#')
 		end++;
@@ -887,10 +1394,10 @@ char_entity(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offs
 	else
 		return 0; /* lone '&' */
 
-	if (rndr->cb.entity) {
+	if (rndr->parser->cb.entity) {
 		work.data = data;
 		work.size = end;
-		rndr->cb.entity(ob, &work, rndr->opaque);
+		rndr->parser->cb.entity(ob, &work, rndr->opaque);
 	}
 	else bufput(ob, data, end);
 
@@ -903,20 +1410,20 @@ char_langle_tag(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 {
 	enum mkd_autolink altype = MKDA_NOT_AUTOLINK;
 	size_t end = tag_length(data, size, &altype);
-	struct buf work = { data, end, 0, 0 };
+	struct buf work = { data, end, 0, 0, BUF_GROW_UNIT, NULL };
 	int ret = 0;
 
 	if (end > 2) {
-		if (rndr->cb.autolink && altype != MKDA_NOT_AUTOLINK) {
+		if (rndr->parser->cb.autolink && altype != MKDA_NOT_AUTOLINK) {
 			struct buf *u_link = rndr_newbuf(rndr, BUFFER_SPAN);
 			work.data = data + 1;
 			work.size = end - 2;
 			unscape_text(u_link, &work);
-			ret = rndr->cb.autolink(ob, u_link, altype, rndr->opaque);
+			ret = rndr->parser->cb.autolink(ob, u_link, altype, rndr->opaque);
 			rndr_popbuf(rndr, BUFFER_SPAN);
 		}
-		else if (rndr->cb.raw_html_tag)
-			ret = rndr->cb.raw_html_tag(ob, &work, rndr->opaque);
+		else if (rndr->parser->cb.raw_html_tag)
+			ret = rndr->parser->cb.raw_html_tag(ob, &work, rndr->opaque);
 	}
 
 	if (!ret) return 0;
@@ -929,7 +1436,7 @@ char_autolink_www(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_
 	struct buf *link, *link_url, *link_text;
 	size_t link_len, rewind;
 
-	if (!rndr->cb.link || rndr->in_link_body)
+	if (!rndr->parser->cb.link || rndr->in_link_body)
 		return 0;
 
 	link = rndr_newbuf(rndr, BUFFER_SPAN);
@@ -939,14 +1446,14 @@ char_autolink_www(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_
 		BUFPUTSL(link_url, "http://");
 		bufput(link_url, link->data, link->size);
 
-		ob->size -= rewind;
-		if (rndr->cb.normal_text) {
+		rndr_rewind(rndr, ob, rewind);
+		if (rndr->parser->cb.normal_text) {
 			link_text = rndr_newbuf(rndr, BUFFER_SPAN);
-			rndr->cb.normal_text(link_text, link, rndr->opaque);
-			rndr->cb.link(ob, link_url, NULL, link_text, rndr->opaque);
+			rndr->parser->cb.normal_text(link_text, link, rndr->opaque);
+			rndr->parser->cb.link(ob, link_url, NULL, link_text, rndr->opaque);
 			rndr_popbuf(rndr, BUFFER_SPAN);
 		} else {
-			rndr->cb.link(ob, link_url, NULL, link, rndr->opaque);
+			rndr->parser->cb.link(ob, link_url, NULL, link, rndr->opaque);
 		}
 		rndr_popbuf(rndr, BUFFER_SPAN);
 	}
@@ -961,14 +1468,14 @@ char_autolink_email(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, siz
 	struct buf *link;
 	size_t link_len, rewind;
 
-	if (!rndr->cb.autolink || rndr->in_link_body)
+	if (!rndr->parser->cb.autolink || rndr->in_link_body)
 		return 0;
 
 	link = rndr_newbuf(rndr, BUFFER_SPAN);
 
 	if ((link_len = sd_autolink__email(&rewind, link, data, offset, size, 0)) > 0) {
-		ob->size -= rewind;
-		rndr->cb.autolink(ob, link, MKDA_EMAIL, rndr->opaque);
+		rndr_rewind(rndr, ob, rewind);
+		rndr->parser->cb.autolink(ob, link, MKDA_EMAIL, rndr->opaque);
 	}
 
 	rndr_popbuf(rndr, BUFFER_SPAN);
@@ -981,42 +1488,136 @@ char_autolink_url(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_
 	struct buf *link;
 	size_t link_len, rewind;
 
-	if (!rndr->cb.autolink || rndr->in_link_body)
+	if (!rndr->parser->cb.autolink || rndr->in_link_body)
 		return 0;
 
 	link = rndr_newbuf(rndr, BUFFER_SPAN);
 
 	if ((link_len = sd_autolink__url(&rewind, link, data, offset, size, SD_AUTOLINK_SHORT_DOMAINS)) > 0) {
-		ob->size -= rewind;
-		rndr->cb.autolink(ob, link, MKDA_NORMAL, rndr->opaque);
+		rndr_rewind(rndr, ob, rewind);
+		rndr->parser->cb.autolink(ob, link, MKDA_NORMAL, rndr->opaque);
 	}
 
 	rndr_popbuf(rndr, BUFFER_SPAN);
 	return link_len;
 }
 
-/* char_link • '[': parsing a link or an image */
+/* span_search • the first of count items, each starting with a
+ * position in the span, which is at pos or after it */
 static size_t
-char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset, size_t size)
+span_search(const void *items, size_t count, size_t stride, size_t pos)
 {
-	int is_img = (offset && data[-1] == '!'), level;
-	size_t i = 1, txt_e, link_b = 0, link_e = 0, title_b = 0, title_e = 0;
-	struct buf *content = 0;
-	struct buf *link = 0;
-	struct buf *title = 0;
-	struct buf *u_link = 0;
-	size_t org_work_size = rndr->work_bufs[BUFFER_SPAN].size;
-	int text_has_nl = 0, ret = 0;
-	int in_title = 0, qtype = 0;
+	size_t lo = 0, hi = count, mid;
 
-	/* checking whether the correct renderer exists */
-	if ((is_img && !rndr->cb.image) || (!is_img && !rndr->cb.link))
-		goto cleanup;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (*(const size_t *)((const uint8_t *)items + mid * stride) < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	/* looking for the matching closing bracket */
-	for (level = 1; i < size; i++) {
+	return lo;
+}
+
+/* index_bracket_pairs • pairs the brackets of the span as the scan of
+ * char_link would: escaped brackets don't count, but an escaped [ still
+ * opens a link, closed by the first ] closing a bracket opened before it */
+static int
+index_bracket_pairs(struct sd_markdown *rndr, struct span_index *span)
+{
+	const uint8_t *data = span->data;
+	size_t size = span->end - span->data, i, opens = 0, closes = 0, top = 0, last_nl = 0;
+	size_t *stack;
+
+	for (i = 0; i < size; ++i) {
+		if (data[i] == '[') opens++;
+		else if (data[i] == ']') closes++;
+	}
+
+	span->pairs = sd_malloc(rndr->allocator, opens * sizeof(struct bracket_pair) + 1);
+	span->closes = sd_malloc(rndr->allocator, closes * sizeof(size_t) + 1);
+	stack = sd_malloc(rndr->allocator, opens * sizeof(size_t) + 1);
+
+	if (!span->pairs || !span->closes || !stack) {
+		sd_free(rndr->allocator, span->pairs);
+		sd_free(rndr->allocator, span->closes);
+		sd_free(rndr->allocator, stack);
+		return 0;
+	}
+
+	span->pair_count = span->pair_cursor = 0;
+	span->close_count = 0;
+
+	for (i = 0; i < size; ++i) {
+		int escaped = i > 0 && data[i - 1] == '\\';
+		struct bracket_pair *pair;
+
+		if (data[i] == '\n') {
+			last_nl = i;
+		} else if (data[i] == '[') {
+			pair = &span->pairs[span->pair_count];
+			pair->open = i;
+			pair->close = 0;
+			pair->has_nl = escaped;	/* for now: whether it doesn't count */
+			stack[top++] = span->pair_count++;
+		} else if (data[i] == ']') {
+			span->closes[span->close_count++] = i;
+			if (escaped)
+				continue;
+
+			/* closing the escaped brackets opened since the last one
+			 * which counts, then that one */
+			while (top > 0) {
+				pair = &span->pairs[stack[--top]];
+				pair->close = i;
+
+				if (!pair->has_nl) {
+					pair->has_nl = last_nl > pair->open;
+					break;
+				}
+				pair->has_nl = last_nl > pair->open;
+			}
+		}
+	}
+
+	/* the brackets left open have no pair */
+	while (top > 0)
+		span->pairs[stack[--top]].has_nl = 0;
+
+	sd_free(rndr->allocator, stack);
+	span->pairs_built = 1;
+	return 1;
+}
+
+/* find_link_text_end • the ] closing the text of a link opened at data,
+ * or 0, and whether there is a newline in between */
+static size_t
+find_link_text_end(struct sd_markdown *rndr, uint8_t *data, size_t size, int *has_nl)
+{
+	struct span_index *span = rndr->span;
+	struct bracket_pair *pair;
+	size_t i, pos;
+	int level;
+
+	if (span && span->end == data + size &&
+		(span->pairs_built || index_bracket_pairs(rndr, span))) {
+		pos = data - span->data;
+
+		if (span->pair_cursor < span->pair_count && span->pairs[span->pair_cursor].open > pos)
+			span->pair_cursor = 0;
+		while (span->pair_cursor < span->pair_count && span->pairs[span->pair_cursor].open < pos)
+			span->pair_cursor++;
+
+		pair = &span->pairs[span->pair_cursor];
+		*has_nl = pair->has_nl;
+		return pair->close ? pair->close - pos : 0;
+	}
+
+	*has_nl = 0;
+	for (i = 1, level = 1; i < size; i++) {
 		if (data[i] == '\n')
-			text_has_nl = 1;
+			*has_nl = 1;
 
 		else if (data[i - 1] == '\\')
 			continue;
@@ -1031,18 +1632,247 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset
 		}
 	}
 
-	if (i >= size)
+	return i < size ? i : 0;
+}
+
+/* find_bracket_close • the first ] from i on, or size */
+static size_t
+find_bracket_close(struct sd_markdown *rndr, uint8_t *data, size_t size, size_t i)
+{
+	struct span_index *span = rndr->span;
+	size_t pos, close;
+
+	if (span && span->pairs_built && span->end == data + size) {
+		pos = data + i - span->data;
+		close = span_search(span->closes, span->close_count, sizeof(size_t), pos);
+
+		return close < span->close_count ? span->closes[close] - (pos - i) : size;
+	}
+
+	while (i < size && data[i] != ']') i++;
+	return i;
+}
+
+/* index_link_parens • lists the parentheses of the span which the
+ * scan of a link destination sees, and where such a scan starting at
+ * each of them ends. Destinations start after a ( or a space, never
+ * within a run of backslashes, so which characters are escaped is the
+ * same for all of them */
+static int
+index_link_parens(struct sd_markdown *rndr, struct span_index *span)
+{
+	const uint8_t *data = span->data;
+	size_t size = span->end - span->data, i, j, k, parens = 0, quotes = 0, top = 0, backslashes = 0;
+	size_t *stack;
+
+	for (i = 0; i < size; ++i) {
+		if (data[i] == '(' || data[i] == ')') parens++;
+		else if ((data[i] == '\'' || data[i] == '"') && i > 0 && _isspace(data[i - 1])) quotes++;
+	}
+
+	span->parens = sd_malloc(rndr->allocator, parens * sizeof(struct paren) + 1);
+	span->quotes = sd_malloc(rndr->allocator, quotes * sizeof(size_t) + 1);
+	stack = sd_malloc(rndr->allocator, parens * sizeof(size_t) + 1);
+
+	if (!span->parens || !span->quotes || !stack) {
+		sd_free(rndr->allocator, span->parens);
+		sd_free(rndr->allocator, span->quotes);
+		sd_free(rndr->allocator, stack);
+		return 0;
+	}
+
+	span->paren_count = 0;
+	span->quote_count = 0;
+
+	/* pairing them, each ( holding the index of its ) for now */
+	for (i = 0; i < size; ++i) {
+		if (data[i] == '\\') {
+			backslashes++;
+			continue;
+		}
+
+		if (backslashes & 1) {
+			backslashes = 0;
+			continue;
+		}
+		backslashes = 0;
+
+		if (data[i] == '(') {
+			span->parens[span->paren_count].pos = i;
+			span->parens[span->paren_count].end = (size_t)-1;
+			stack[top++] = span->paren_count++;
+		} else if (data[i] == ')') {
+			span->parens[span->paren_count].pos = i;
+			span->parens[span->paren_count].end = i;
+			if (top > 0)
+				span->parens[stack[--top]].end = span->paren_count;
+			span->paren_count++;
+		} else if ((data[i] == '\'' || data[i] == '"') && i > 0 && _isspace(data[i - 1])) {
+			span->quotes[span->quote_count++] = i;
+		}
+	}
+
+	/* a destination stops at a ), and goes over a ( to what follows its ) */
+	for (j = span->paren_count; j-- > 0; ) {
+		if (data[span->parens[j].pos] == ')')
+			continue;
+
+		k = span->parens[j].end;
+		if (k == (size_t)-1 || k + 1 >= span->paren_count)
+			span->parens[j].end = 0;
+		else
+			span->parens[j].end = span->parens[k + 1].end;
+	}
+
+	sd_free(rndr->allocator, stack);
+	span->parens_built = 1;
+	return 1;
+}
+
+/* find_link_dest_end • the ) or the quote ending the destination of
+ * an inline link which starts at i, or size */
+static size_t
+find_link_dest_end(struct sd_markdown *rndr, uint8_t *data, size_t size, size_t i)
+{
+	struct span_index *span = rndr->span;
+	size_t nb_p = 0, pos, end = 0, j;
+
+	if (span && span->end == data + size &&
+		(span->parens_built || index_link_parens(rndr, span))) {
+		pos = data + i - span->data;
+
+		j = span_search(span->parens, span->paren_count, sizeof(struct paren), pos);
+		if (j < span->paren_count)
+			end = span->parens[j].end;
+
+		j = span_search(span->quotes, span->quote_count, sizeof(size_t), pos);
+		if (j < span->quote_count && (!end || span->quotes[j] < end))
+			end = span->quotes[j];
+
+		return end ? end - (pos - i) : size;
+	}
+
+	while (i < size) {
+		if (data[i] == '\\') i += 2;
+		else if (data[i] == '(' && i != 0) {
+			nb_p++; i++;
+		}
+		else if (data[i] == ')') {
+			if (nb_p == 0) break;
+			else nb_p--; i++;
+		} else if (i >= 1 && _isspace(data[i-1]) && (data[i] == '\'' || data[i] == '"')) break;
+		else i++;
+	}
+
+	return i;
+}
+
+/* scan_link_title • follows the title of an inline link from i to the )
+ * after it, or to size; when marking, records every position it goes
+ * through as failed */
+static size_t
+scan_link_title(struct sd_markdown *rndr, uint8_t *data, size_t size, size_t i, uint8_t qtype, int marking)
+{
+	int in_title = 1, scan;
+	uint8_t *bits, mask;
+
+	while (i < size) {
+		scan = !in_title ? SCAN_LINK_TITLE_END :
+			qtype == '"' ? SCAN_LINK_TITLE_DQ : SCAN_LINK_TITLE_SQ;
+
+		bits = scan_failed_bit(rndr->span, data + i, scan, &mask);
+		if (bits && (*bits & mask))
+			return size;
+		if (marking && bits)
+			*bits |= mask;
+
+		if (data[i] == '\\') i += 2;
+		else if (data[i] == qtype) {in_title = 0; i++;}
+		else if ((data[i] == ')') && !in_title) break;
+		else i++;
+	}
+
+	return i;
+}
+
+/* find_link_title_end • the ) after the title of an inline link, or
+ * size; failed scans are remembered */
+static size_t
+find_link_title_end(struct sd_markdown *rndr, uint8_t *data, size_t size, size_t i, uint8_t qtype)
+{
+	size_t end = scan_link_title(rndr, data, size, i, qtype, 0);
+
+	if (end >= size && i < size && rndr->span && rndr->span->end == data + size &&
+		scan_failed_grow(rndr, data + i, qtype == '"' ? SCAN_LINK_TITLE_DQ : SCAN_LINK_TITLE_SQ) &&
+		scan_failed_grow(rndr, data + i, SCAN_LINK_TITLE_END))
+		scan_link_title(rndr, data, size, i, qtype, 1);
+
+	return end;
+}
+
+/* link_text_id • the id of a reference named by the text of a link,
+ * with its newlines folded; 0 when it is too long to name one */
+static int
+link_text_id(struct sd_markdown *rndr, uint8_t *data, size_t txt_e, int text_has_nl, struct buf *id)
+{
+	struct buf *b;
+	size_t j;
+
+	if (!text_has_nl) {
+		id->data = data + 1;
+		id->size = txt_e - 1;
+		return 1;
+	}
+
+	/* folding keeps at least every other character */
+	if ((txt_e - 1) / 2 > rndr->refs.longest)
+		return 0;
+
+	b = rndr_newbuf(rndr, BUFFER_SPAN);
+	for (j = 1; j < txt_e; j++) {
+		if (data[j] != '\n')
+			bufputc(b, data[j]);
+		else if (data[j - 1] != ' ')
+			bufputc(b, ' ');
+	}
+
+	id->data = b->data;
+	id->size = b->size;
+	return 1;
+}
+
+/* char_link • '[': parsing a link or an image */
+static size_t
+char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset, size_t size)
+{
+	int is_img = (offset && data[-1] == '!');
+	size_t i = 1, txt_e, link_b = 0, link_e = 0, title_b = 0, title_e = 0;
+	struct buf *content = 0;
+	struct buf *link = 0;
+	struct buf *title = 0;
+	struct buf *u_link = 0;
+	size_t org_work_size = rndr->work_bufs[BUFFER_SPAN].size;
+	int text_has_nl = 0, ret = 0;
+	uint8_t qtype = 0;
+
+	/* checking whether the correct renderer exists */
+	if ((is_img && !rndr->parser->cb.image) || (!is_img && !rndr->parser->cb.link))
+		goto cleanup;
+
+	/* looking for the matching closing bracket */
+	i = find_link_text_end(rndr, data, size, &text_has_nl);
+	if (!i)
 		goto cleanup;
 
 	txt_e = i;
 	i++;
 
 	/* footnote link */
-	if (rndr->ext_flags & MKDEXT_FOOTNOTES && data[1] == '^') {
+	if (rndr->parser->ext_flags & MKDEXT_FOOTNOTES && data[1] == '^') {
 		if (txt_e < 3)
 			goto cleanup;
 
-		struct buf id = { 0, 0, 0, 0 };
+		struct buf id = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
 		struct footnote_ref *fr;
 
 		id.data = data + 2;
@@ -1052,15 +1882,15 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset
 
 		/* mark footnote used */
 		if (fr && !fr->is_used) {
-			if(!add_footnote_ref(&rndr->footnotes_used, fr))
+			if(!add_footnote_ref(&rndr->arena, &rndr->footnotes_used, fr))
 				goto cleanup;
 			fr->is_used = 1;
 			fr->num = rndr->footnotes_used.count;
 		}
 
 		/* render */
-		if (fr && rndr->cb.footnote_ref)
-				ret = rndr->cb.footnote_ref(ob, fr->num, rndr->opaque);
+		if (fr && rndr->parser->cb.footnote_ref)
+				ret = rndr->parser->cb.footnote_ref(ob, fr->num, rndr->opaque);
 
 		goto cleanup;
 	}
@@ -1081,38 +1911,17 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset
 		link_b = i;
 
 		/* looking for link end: ' " ) */
-		/* Count the number of open parenthesis */
-		size_t nb_p = 0;
-
-		while (i < size) {
-			if (data[i] == '\\') i += 2;
-			else if (data[i] == '(' && i != 0) {
-				nb_p++; i++;
-			}
-			else if (data[i] == ')') {
-				if (nb_p == 0) break;
-				else nb_p--; i++;
-			} else if (i >= 1 && _isspace(data[i-1]) && (data[i] == '\'' || data[i] == '"')) break;
-			else i++;
-		}
-
+		i = find_link_dest_end(rndr, data, size, i);
 		if (i >= size) goto cleanup;
 		link_e = i;
 
 		/* looking for title end if present */
 		if (data[i] == '\'' || data[i] == '"') {
 			qtype = data[i];
-			in_title = 1;
 			i++;
 			title_b = i;
 
-			while (i < size) {
-				if (data[i] == '\\') i += 2;
-				else if (data[i] == qtype) {in_title = 0; i++;}
-				else if ((data[i] == ')') && !in_title) break;
-				else i++;
-			}
-
+			i = find_link_title_end(rndr, data, size, i, qtype);
 			if (i >= size) goto cleanup;
 
 			/* skipping whitespaces after title */
@@ -1151,41 +1960,26 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset
 
 	/* reference style link */
 	else if (i < size && data[i] == '[') {
-		struct buf id = { 0, 0, 0, 0 };
+		struct buf id = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
 		struct link_ref *lr;
 
 		/* looking for the id */
 		i++;
 		link_b = i;
-		while (i < size && data[i] != ']') i++;
+		i = find_bracket_close(rndr, data, size, i);
 		if (i >= size) goto cleanup;
 		link_e = i;
 
 		/* finding the link_ref */
 		if (link_b == link_e) {
-			if (text_has_nl) {
-				struct buf *b = rndr_newbuf(rndr, BUFFER_SPAN);
-				size_t j;
-
-				for (j = 1; j < txt_e; j++) {
-					if (data[j] != '\n')
-						bufputc(b, data[j]);
-					else if (data[j - 1] != ' ')
-						bufputc(b, ' ');
-				}
-
-				id.data = b->data;
-				id.size = b->size;
-			} else {
-				id.data = data + 1;
-				id.size = txt_e - 1;
-			}
+			if (!link_text_id(rndr, data, txt_e, text_has_nl, &id))
+				goto cleanup;
 		} else {
 			id.data = data + link_b;
 			id.size = link_e - link_b;
 		}
 
-		lr = find_link_ref(rndr->refs, id.data, id.size);
+		lr = find_link_ref(&rndr->refs, id.data, id.size);
 		if (!lr)
 			goto cleanup;
 
@@ -1197,30 +1991,15 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset
 
 	/* shortcut reference style link */
 	else {
-		struct buf id = { 0, 0, 0, 0 };
+		struct buf id = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
 		struct link_ref *lr;
 
 		/* crafting the id */
-		if (text_has_nl) {
-			struct buf *b = rndr_newbuf(rndr, BUFFER_SPAN);
-			size_t j;
-
-			for (j = 1; j < txt_e; j++) {
-				if (data[j] != '\n')
-					bufputc(b, data[j]);
-				else if (data[j - 1] != ' ')
-					bufputc(b, ' ');
-			}
-
-			id.data = b->data;
-			id.size = b->size;
-		} else {
-			id.data = data + 1;
-			id.size = txt_e - 1;
-		}
+		if (!link_text_id(rndr, data, txt_e, text_has_nl, &id))
+			goto cleanup;
 
 		/* finding the link_ref */
-		lr = find_link_ref(rndr->refs, id.data, id.size);
+		lr = find_link_ref(&rndr->refs, id.data, id.size);
 		if (!lr)
 			goto cleanup;
 
@@ -1253,12 +2032,12 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset
 
 	/* calling the relevant rendering function */
 	if (is_img) {
-		if (ob->size && ob->data[ob->size - 1] == '!')
-			ob->size -= 1;
+		if (rndr_last_char(rndr, ob) == '!')
+			rndr_rewind(rndr, ob, 1);
 
-		ret = rndr->cb.image(ob, u_link, title, content, rndr->opaque);
+		ret = rndr->parser->cb.image(ob, u_link, title, content, rndr->opaque);
 	} else {
-		ret = rndr->cb.link(ob, u_link, title, content, rndr->opaque);
+		ret = rndr->parser->cb.link(ob, u_link, title, content, rndr->opaque);
 	}
 
 	/* cleanup */
@@ -1273,7 +2052,7 @@ char_superscript(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 	size_t sup_start, sup_len;
 	struct buf *sup;
 
-	if (!rndr->cb.superscript)
+	if (!rndr->parser->cb.superscript)
 		return 0;
 
 	if (size < 2)
@@ -1299,7 +2078,7 @@ char_superscript(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 
 	sup = rndr_newbuf(rndr, BUFFER_SPAN);
 	parse_inline(sup, rndr, data + sup_start, sup_len - sup_start);
-	rndr->cb.superscript(ob, sup, rndr->opaque);
+	rndr->parser->cb.superscript(ob, sup, rndr->opaque);
 	rndr_popbuf(rndr, BUFFER_SPAN);
 
 	return (sup_start == 2) ? sup_len + 1 : sup_len;
@@ -1309,6 +2088,58 @@ char_superscript(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
  * BLOCK-LEVEL PARSING FUNCTIONS *
  *********************************/
 
+/* line_kind: the blocks a line may start, or go on, going by its first
+ * byte after up to three spaces of indentation. Each of the predicates
+ * below needs its line to be of some kind to return anything, so the
+ * block parsers only run those the line can pass */
+enum line_kind {
+	LINE_EMPTY = (1 << 0),
+	LINE_CODE = (1 << 1),	/* a fourth space */
+	LINE_ATX = (1 << 2),
+	LINE_SETEXT = (1 << 3),	/* the underline of a header */
+	LINE_HRULE = (1 << 4),
+	LINE_QUOTE = (1 << 5),
+	LINE_ULI = (1 << 6),
+	LINE_OLI = (1 << 7),
+	LINE_FENCE = (1 << 8),
+	LINE_HTML = (1 << 9)
+};
+
+static const uint16_t line_kinds_of[256] = {
+	[' '] = LINE_EMPTY | LINE_CODE, ['\n'] = LINE_EMPTY,
+	['#'] = LINE_ATX,
+	['='] = LINE_SETEXT,
+	['-'] = LINE_SETEXT | LINE_HRULE | LINE_ULI,
+	['*'] = LINE_HRULE | LINE_ULI,
+	['_'] = LINE_HRULE,
+	['+'] = LINE_ULI,
+	['>'] = LINE_QUOTE,
+	['0'] = LINE_OLI, ['1'] = LINE_OLI, ['2'] = LINE_OLI, ['3'] = LINE_OLI, ['4'] = LINE_OLI,
+	['5'] = LINE_OLI, ['6'] = LINE_OLI, ['7'] = LINE_OLI, ['8'] = LINE_OLI, ['9'] = LINE_OLI,
+	['`'] = LINE_FENCE, ['~'] = LINE_FENCE,
+	['<'] = LINE_HTML
+};
+
+/* line_kinds • the kinds of the line starting at data */
+static inline unsigned int
+line_kinds(const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < 3 && i < size && data[i] == ' ')
+		i++;
+
+	return line_kinds_of[i < size ? data[i] : '\n'];
+}
+
+/* line_end • where the line starting at data ends, past its newline */
+static inline size_t
+line_end(const uint8_t *data, size_t size)
+{
+	const uint8_t *nl = memchr(data, '\n', size);
+	return nl ? (size_t)(nl - data) + 1 : size;
+}
+
 /* is_empty • returns the line length when it is empty, 0 otherwise */
 static size_t
 is_empty(const uint8_t *data, size_t size)
@@ -1403,7 +2234,7 @@ is_codefence(uint8_t *data, size_t size, struct buf *curdelim, struct buf *synta
 {
 	size_t i = 0, syn_len = 0;
 	uint8_t *syn_start;
-	struct buf delim = { 0, 0, 0, 0 };
+	struct buf delim = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
 
 	i = prefix_codefence(data, size, &delim, curdelim);
 
@@ -1477,7 +2308,7 @@ is_atxheader(struct sd_markdown *rndr, uint8_t *data, size_t size)
 	if (data[0] != '#')
 		return 0;
 
-	if (rndr->ext_flags & MKDEXT_SPACE_HEADERS) {
+	if (rndr->parser->ext_flags & MKDEXT_SPACE_HEADERS) {
 		size_t level = 0;
 
 		while (level < size && level < 6 && data[level] == '#')
@@ -1612,9 +2443,10 @@ parse_blockquote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 {
 	size_t beg, end = 0, pre, work_size = 0;
 	uint8_t *work_data = 0;
-	struct buf *out = 0;
+	struct buf *out = 0, *work;
 
 	out = rndr_newbuf(rndr, BUFFER_BLOCK);
+	work = rndr_workbuf(rndr, data);
 	beg = 0;
 	while (beg < size) {
 		for (end = beg + 1; end < size && data[end - 1] != '\n'; end++);
@@ -1631,8 +2463,9 @@ parse_blockquote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 			break;
 
 		if (beg < end) { /* copy into the in-place working buffer */
-			/* bufput(work, data + beg, end - beg); */
-			if (!work_data)
+			if (work)
+				bufput(work, data + beg, end - beg);
+			else if (!work_data)
 				work_data = data + beg;
 			else if (data + beg != work_data + work_size)
 				memmove(work_data + work_size, data + beg, end - beg);
@@ -1641,9 +2474,12 @@ parse_blockquote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 		beg = end;
 	}
 
+	if (work)
+		work_data = work->data;
+
 	parse_block(out, rndr, work_data, work_size);
-	if (rndr->cb.blockquote)
-		rndr->cb.blockquote(ob, out, rndr->opaque);
+	if (rndr->parser->cb.blockquote)
+		rndr->parser->cb.blockquote(ob, out, rndr->opaque);
 	rndr_popbuf(rndr, BUFFER_BLOCK);
 	return end;
 }
@@ -1656,23 +2492,26 @@ static size_t
 parse_paragraph(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
 {
 	size_t i = 0, end = 0;
+	unsigned int kinds;
 	int level = 0, last_is_empty = 1;
-	struct buf work = { data, 0, 0, 0 };
+	struct buf work = { data, 0, 0, 0, BUF_GROW_UNIT, NULL };
 
 	while (i < size) {
-		for (end = i + 1; end < size && data[end - 1] != '\n'; end++) /* empty */;
+		end = i + line_end(data + i, size - i);
+		kinds = line_kinds(data + i, size - i);
 
-		if (is_empty(data + i, size - i))
+		if ((kinds & LINE_EMPTY) && is_empty(data + i, size - i))
 			break;
 
-		if (!last_is_empty && (level = is_headerline(data + i, size - i)) != 0)
+		if (!last_is_empty && (kinds & LINE_SETEXT) &&
+			(level = is_headerline(data + i, size - i)) != 0)
 			break;
 
 		last_is_empty = 0;
 
-		if (is_atxheader(rndr, data + i, size - i) ||
-			is_hrule(data + i, size - i) ||
-			prefix_quote(data + i, size - i)) {
+		if (((kinds & LINE_ATX) && is_atxheader(rndr, data + i, size - i)) ||
+			((kinds & LINE_HRULE) && is_hrule(data + i, size - i)) ||
+			((kinds & LINE_QUOTE) && prefix_quote(data + i, size - i))) {
 			end = i;
 			break;
 		}
@@ -1686,22 +2525,22 @@ parse_paragraph(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 		 * let's check to see if there's some kind of block starting
 		 * here
 		 */
-		if ((rndr->ext_flags & MKDEXT_LAX_SPACING) && !isalpha(data[i])) {
-			if (prefix_oli(data + i, size - i) ||
-				prefix_uli(data + i, size - i)) {
+		if ((rndr->parser->ext_flags & MKDEXT_LAX_SPACING) && !isalpha(data[i])) {
+			if (((kinds & LINE_OLI) && prefix_oli(data + i, size - i)) ||
+				((kinds & LINE_ULI) && prefix_uli(data + i, size - i))) {
 				end = i;
 				break;
 			}
 
 			/* see if an html block starts here */
-			if (data[i] == '<' && rndr->cb.blockhtml &&
+			if (data[i] == '<' && rndr->parser->cb.blockhtml &&
 				parse_htmlblock(ob, rndr, data + i, size - i, 0)) {
 				end = i;
 				break;
 			}
 
 			/* see if a code fence starts here */
-			if ((rndr->ext_flags & MKDEXT_FENCED_CODE) != 0 &&
+			if ((rndr->parser->ext_flags & MKDEXT_FENCED_CODE) != 0 && (kinds & LINE_FENCE) &&
 				is_codefence(data + i, size - i, NULL, NULL) != 0) {
 				end = i;
 				break;
@@ -1718,8 +2557,8 @@ parse_paragraph(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 	if (!level) {
 		struct buf *tmp = rndr_newbuf(rndr, BUFFER_BLOCK);
 		parse_inline(tmp, rndr, work.data, work.size);
-		if (rndr->cb.paragraph)
-			rndr->cb.paragraph(ob, tmp, rndr->opaque);
+		if (rndr->parser->cb.paragraph)
+			rndr->parser->cb.paragraph(ob, tmp, rndr->opaque);
 		rndr_popbuf(rndr, BUFFER_BLOCK);
 	} else {
 		struct buf *header_work;
@@ -1740,8 +2579,8 @@ parse_paragraph(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 				struct buf *tmp = rndr_newbuf(rndr, BUFFER_BLOCK);
 				parse_inline(tmp, rndr, work.data, work.size);
 
-				if (rndr->cb.paragraph)
-					rndr->cb.paragraph(ob, tmp, rndr->opaque);
+				if (rndr->parser->cb.paragraph)
+					rndr->parser->cb.paragraph(ob, tmp, rndr->opaque);
 
 				rndr_popbuf(rndr, BUFFER_BLOCK);
 				work.data += beg;
@@ -1753,8 +2592,8 @@ parse_paragraph(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 		header_work = rndr_newbuf(rndr, BUFFER_SPAN);
 		parse_inline(header_work, rndr, work.data, work.size);
 
-		if (rndr->cb.header)
-			rndr->cb.header(ob, header_work, (int)level, rndr->opaque);
+		if (rndr->parser->cb.header)
+			rndr->parser->cb.header(ob, header_work, (int)level, rndr->opaque);
 
 		rndr_popbuf(rndr, BUFFER_SPAN);
 	}
@@ -1768,8 +2607,8 @@ parse_fencedcode(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 {
 	size_t beg, end;
 	struct buf *work = 0;
-	struct buf delim = { 0, 0, 0, 0 };
-	struct buf lang = { 0, 0, 0, 0 };
+	struct buf delim = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
+	struct buf lang = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
 
 	beg = is_codefence(data, size, &delim, &lang);
 	if (beg == 0) return 0;
@@ -1800,8 +2639,8 @@ parse_fencedcode(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 	if (work->size && work->data[work->size - 1] != '\n')
 		bufputc(work, '\n');
 
-	if (rndr->cb.blockcode)
-		rndr->cb.blockcode(ob, work, lang.size ? &lang : NULL, rndr->opaque);
+	if (rndr->parser->cb.blockcode)
+		rndr->parser->cb.blockcode(ob, work, lang.size ? &lang : NULL, rndr->opaque);
 
 	rndr_popbuf(rndr, BUFFER_BLOCK);
 	return beg;
@@ -1841,8 +2680,8 @@ parse_blockcode(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 
 	bufputc(work, '\n');
 
-	if (rndr->cb.blockcode)
-		rndr->cb.blockcode(ob, work, NULL, rndr->opaque);
+	if (rndr->parser->cb.blockcode)
+		rndr->parser->cb.blockcode(ob, work, NULL, rndr->opaque);
 
 	rndr_popbuf(rndr, BUFFER_BLOCK);
 	return beg;
@@ -1853,10 +2692,13 @@ parse_blockcode(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 static size_t
 parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, int *flags)
 {
-	struct buf *work = 0, *inter = 0;
+	struct buf *inter = 0, *work;
 	size_t beg = 0, end, pre, sublist = 0, orgpre = 0, i;
+	size_t work_size = 0;
+	uint8_t *work_data = 0;
 	int in_empty = 0, has_inside_empty = 0, in_fence = 0;
-	struct buf fence_delim = { 0, 0, 0, 0 };
+	struct buf fence_delim = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
+	uint8_t fence_char = 0;
 
 	/* keeping track of the first indentation prefix */
 	while (orgpre < 3 && orgpre < size && data[orgpre] == ' ')
@@ -1874,25 +2716,33 @@ parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t s
 	while (end < size && data[end - 1] != '\n')
 		end++;
 
-	/* getting working buffers */
-	work = rndr_newbuf(rndr, BUFFER_SPAN);
+	/* getting working buffers; the item's contents are compacted in
+	 * place like a blockquote's, which still moves them once for every
+	 * level of nesting (and copies them once into borrowed_work when
+	 * the document is the caller's), but it keeps holding a span buffer
+	 * so that lists weigh the same against max_nesting as they did
+	 * when the contents were copied there */
+	rndr_newbuf(rndr, BUFFER_SPAN);
 	inter = rndr_newbuf(rndr, BUFFER_SPAN);
 
-	/* putting the first line into the working buffer */
-	bufput(work, data + beg, end - beg);
+	/* the first line is already in place */
+	work = rndr_workbuf(rndr, data);
+	if (work)
+		bufput(work, data + beg, end - beg);
+	else
+		work_data = data + beg;
+	work_size = end - beg;
 	beg = end;
 
 	/* process the following lines */
 	while (beg < size) {
 		size_t has_next_uli = 0, has_next_oli = 0;
+		unsigned int kinds;
 
-		end++;
-
-		while (end < size && data[end - 1] != '\n')
-			end++;
+		end = beg + line_end(data + beg, size - beg);
 
 		/* process an empty line */
-		if (is_empty(data + beg, end - beg)) {
+		if ((line_kinds(data + beg, end - beg) & LINE_EMPTY) && is_empty(data + beg, end - beg)) {
 			in_empty = 1;
 			beg = end;
 			continue;
@@ -1904,17 +2754,27 @@ parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t s
 			i++;
 
 		pre = i;
+		kinds = line_kinds(data + beg + i, end - beg - i);
 
-		if (rndr->ext_flags & MKDEXT_FENCED_CODE) {
+		if ((rndr->parser->ext_flags & MKDEXT_FENCED_CODE) && (kinds & LINE_FENCE)) {
 			if (is_codefence(data + beg + i, end - beg - i, &fence_delim, NULL) != 0)
 				in_fence = !in_fence;
+
+			/* the opening fence may be compacted over before its
+			 * closing line is seen, so keep its character aside */
+			if (fence_delim.size) {
+				fence_char = fence_delim.data[0];
+				fence_delim.data = &fence_char;
+			}
 		}
 
 		/* Only check for new list items if we are **not** inside
 		 * a fenced code block */
 		if (!in_fence) {
-			has_next_uli = prefix_uli(data + beg + i, end - beg - i);
-			has_next_oli = prefix_oli(data + beg + i, end - beg - i);
+			if (kinds & LINE_ULI)
+				has_next_uli = prefix_uli(data + beg + i, end - beg - i);
+			if (kinds & LINE_OLI)
+				has_next_oli = prefix_oli(data + beg + i, end - beg - i);
 		}
 
 		/* checking for ul/ol switch */
@@ -1934,7 +2794,7 @@ parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t s
 				break;             /* the same indentation */
 
 			if (!sublist)
-				sublist = work->size;
+				sublist = work_size;
 		}
 		/* joining only indented stuff after empty lines */
 		else if (in_empty && i < 4 && data[beg] != '\t') {
@@ -1942,42 +2802,56 @@ parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t s
 			break;
 		}
 		else if (in_empty) {
-			bufputc(work, '\n');
+			/* the skipped empty line leaves room for this one */
+			if (work)
+				bufputc(work, '\n');
+			else
+				work_data[work_size] = '\n';
+			work_size++;
 			has_inside_empty = 1;
 		}
 
 		in_empty = 0;
 
-		/* adding the line without prefix into the working buffer */
-		bufput(work, data + beg + i, end - beg - i);
+		/* compacting the line without prefix in place; the output
+		 * never catches up with the input since at least the prefix
+		 * or an empty line has been dropped before it */
+		if (work)
+			bufput(work, data + beg + i, end - beg - i);
+		else if (work_data + work_size != data + beg + i)
+			memmove(work_data + work_size, data + beg + i, end - beg - i);
+		work_size += end - beg - i;
 		beg = end;
 	}
 
+	if (work)
+		work_data = work->data;
+
 	/* render of li contents */
 	if (has_inside_empty)
 		*flags |= MKD_LI_BLOCK;
 
 	if (*flags & MKD_LI_BLOCK) {
 		/* intermediate render of block li */
-		if (sublist && sublist < work->size) {
-			parse_block(inter, rndr, work->data, sublist);
-			parse_block(inter, rndr, work->data + sublist, work->size - sublist);
+		if (sublist && sublist < work_size) {
+			parse_block(inter, rndr, work_data, sublist);
+			parse_block(inter, rndr, work_data + sublist, work_size - sublist);
 		}
 		else
-			parse_block(inter, rndr, work->data, work->size);
+			parse_block(inter, rndr, work_data, work_size);
 	} else {
 		/* intermediate render of inline li */
-		if (sublist && sublist < work->size) {
-			parse_inline(inter, rndr, work->data, sublist);
-			parse_block(inter, rndr, work->data + sublist, work->size - sublist);
+		if (sublist && sublist < work_size) {
+			parse_inline(inter, rndr, work_data, sublist);
+			parse_block(inter, rndr, work_data + sublist, work_size - sublist);
 		}
 		else
-			parse_inline(inter, rndr, work->data, work->size);
+			parse_inline(inter, rndr, work_data, work_size);
 	}
 
 	/* render of li itself */
-	if (rndr->cb.listitem)
-		rndr->cb.listitem(ob, inter, *flags, rndr->opaque);
+	if (rndr->parser->cb.listitem)
+		rndr->parser->cb.listitem(ob, inter, *flags, rndr->opaque);
 
 	rndr_popbuf(rndr, BUFFER_SPAN);
 	rndr_popbuf(rndr, BUFFER_SPAN);
@@ -2002,8 +2876,8 @@ parse_list(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size,
 			break;
 	}
 
-	if (rndr->cb.list)
-		rndr->cb.list(ob, work, flags, rndr->opaque);
+	if (rndr->parser->cb.list)
+		rndr->parser->cb.list(ob, work, flags, rndr->opaque);
 	rndr_popbuf(rndr, BUFFER_BLOCK);
 	return i;
 }
@@ -2034,8 +2908,8 @@ parse_atxheader(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 
 		parse_inline(work, rndr, data + i, end - i);
 
-		if (rndr->cb.header)
-			rndr->cb.header(ob, work, (int)level, rndr->opaque);
+		if (rndr->parser->cb.header)
+			rndr->parser->cb.header(ob, work, (int)level, rndr->opaque);
 
 		rndr_popbuf(rndr, BUFFER_SPAN);
 	}
@@ -2052,8 +2926,8 @@ parse_footnote_def(struct buf *ob, struct sd_markdown *rndr, unsigned int num, u
 
 	parse_block(work, rndr, data, size);
 
-	if (rndr->cb.footnote_def)
-	rndr->cb.footnote_def(ob, work, num, rndr->opaque);
+	if (rndr->parser->cb.footnote_def)
+	rndr->parser->cb.footnote_def(ob, work, num, rndr->opaque);
 	rndr_popbuf(rndr, BUFFER_SPAN);
 }
 
@@ -2077,8 +2951,8 @@ parse_footnote_list(struct buf *ob, struct sd_markdown *rndr, struct footnote_li
 		item = item->next;
 	}
 
-	if (rndr->cb.footnotes)
-		rndr->cb.footnotes(ob, work, rndr->opaque);
+	if (rndr->parser->cb.footnotes)
+		rndr->parser->cb.footnotes(ob, work, rndr->opaque);
 	rndr_popbuf(rndr, BUFFER_BLOCK);
 }
 
@@ -2114,55 +2988,199 @@ htmlblock_end_tag(
 	return i + w;
 }
 
-static size_t
-htmlblock_end(const char *curtag,
-	struct sd_markdown *rndr,
-	uint8_t *data,
-	size_t size,
-	int start_of_line)
+/* next_closing_tag • the next closing block tag from *pos on which
+ * htmlblock_end_tag accepts, with where it ends */
+static int
+next_closing_tag(struct sd_markdown *rndr, uint8_t *data, size_t size,
+	size_t *pos, const char **tag, size_t *end)
 {
-	size_t tag_size = strlen(curtag);
-	size_t i = 1, end_tag;
-	int block_lines = 0;
-
-	while (i < size) {
-		i++;
-		while (i < size && !(data[i - 1] == '<' && data[i] == '/')) {
-			if (data[i] == '\n')
-				block_lines++;
+	const uint8_t *p;
+	size_t i = *pos, len;
 
-			i++;
-		}
+	while (i + 1 < size && (p = memchr(data + i, '<', size - i - 1)) != NULL) {
+		i = p - data;
 
-		/* If we are only looking for unindented tags, skip the tag
-		 * if it doesn't follow a newline.
-		 *
-		 * The only exception to this is if the tag is still on the
-		 * initial line; in that case it still counts as a closing
-		 * tag
-		 */
-		if (start_of_line && block_lines > 0 && data[i - 2] != '\n')
-			continue;
+		if (data[i + 1] == '/') {
+			for (len = 0; i + 2 + len < size && len <= 10 && isalnum(data[i + 2 + len]); len++);
 
-		if (i + 2 + tag_size >= size)
-			break;
+			if (i + 2 + len < size && data[i + 2 + len] == '>' &&
+				(*tag = find_block_tag((char *)data + i + 2, len)) != NULL &&
+				(*end = htmlblock_end_tag(*tag, len, rndr, data + i, size - i)) != 0) {
+				*pos = i;
+				return 1;
+			}
+		}
 
-		end_tag = htmlblock_end_tag(curtag, tag_size, rndr, data + i - 1, size - i + 1);
-		if (end_tag)
-			return i + end_tag - 1;
+		i++;
 	}
 
 	return 0;
 }
 
-
-/* parse_htmlblock • parsing of inline HTML block */
-static size_t
-parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, int do_render)
+/* index_closing_tags • groups the closing tags of the blocks by name,
+ * in two passes: one counting them, one filling the groups */
+static int
+index_closing_tags(struct sd_markdown *rndr, struct tag_index *tags)
+{
+	uint8_t *data = tags->data;
+	size_t size = tags->end - tags->data, i, end, k, count = 0, bols = 0, asize = 0;
+	struct tag_group *group, *grown;
+	const char *tag;
+	int bol;
+
+	tags->groups = NULL;
+	tags->group_count = 0;
+	tags->closes = NULL;
+	tags->bol = NULL;
+	tags->built = -1;
+
+	for (i = 0; next_closing_tag(rndr, data, size, &i, &tag, &end); ++i) {
+		for (k = 0; k < tags->group_count && tags->groups[k].tag != tag; k++);
+
+		if (k == tags->group_count) {
+			if (k == asize) {
+				asize = asize ? asize * 2 : 8;
+				grown = sd_realloc(rndr->allocator, tags->groups, asize * sizeof(struct tag_group));
+				if (!grown)
+					return 0;
+				tags->groups = grown;
+			}
+
+			group = &tags->groups[tags->group_count++];
+			group->tag = tag;
+			group->count = group->bol_count = 0;
+		}
+
+		bol = i > 0 && data[i - 1] == '\n';
+		tags->groups[k].count++;
+		tags->groups[k].bol_count += bol;
+		count++;
+		bols += bol;
+	}
+
+	for (k = 0, count = 0, bols = 0; k < tags->group_count; ++k) {
+		group = &tags->groups[k];
+		group->first = count;
+		group->bol_first = bols;
+		count += group->count;
+		bols += group->bol_count;
+		group->count = group->bol_count = 0;
+	}
+
+	tags->closes = sd_malloc(rndr->allocator, count * sizeof(struct close_tag) + 1);
+	tags->bol = sd_malloc(rndr->allocator, bols * sizeof(struct close_tag) + 1);
+	if (!tags->closes || !tags->bol)
+		return 0;
+
+	for (i = 0; next_closing_tag(rndr, data, size, &i, &tag, &end); ++i) {
+		for (group = tags->groups; group->tag != tag; group++);
+
+		tags->closes[group->first + group->count].pos = i;
+		tags->closes[group->first + group->count].end = i + end;
+		group->count++;
+
+		if (i > 0 && data[i - 1] == '\n') {
+			tags->bol[group->bol_first + group->bol_count].pos = i;
+			tags->bol[group->bol_first + group->bol_count].end = i + end;
+			group->bol_count++;
+		}
+	}
+
+	tags->built = 1;
+	return 1;
+}
+
+/* find_closing_tag • htmlblock_end, looked up in the closing tags of
+ * the blocks data is the start of the rest of */
+static size_t
+find_closing_tag(struct tag_index *tags, const char *curtag,
+	uint8_t *data, size_t size, int start_of_line)
+{
+	size_t start = data - tags->data, k;
+	const struct tag_group *group = NULL;
+	const struct close_tag *close;
+	const uint8_t *nl;
+
+	for (k = 0; k < tags->group_count && !group; ++k) {
+		if (tags->groups[k].tag == curtag)
+			group = &tags->groups[k];
+	}
+
+	if (!group)
+		return 0;
+
+	k = span_search(tags->closes + group->first, group->count, sizeof(struct close_tag), start + 1);
+	if (k == group->count)
+		return 0;
+
+	/* a tag on the opening line counts even when not starting a line */
+	close = &tags->closes[group->first + k];
+	nl = memchr(data + 1, '\n', size - 1);
+	if (!start_of_line || !nl || close->pos - start < (size_t)(nl - data))
+		return close->end - start;
+
+	k = span_search(tags->bol + group->bol_first, group->bol_count, sizeof(struct close_tag), start + 1);
+	if (k == group->bol_count)
+		return 0;
+
+	return tags->bol[group->bol_first + k].end - start;
+}
+
+static size_t
+htmlblock_end(const char *curtag,
+	struct sd_markdown *rndr,
+	uint8_t *data,
+	size_t size,
+	int start_of_line)
+{
+	size_t tag_size = strlen(curtag);
+	size_t i = 1, end_tag;
+	int block_lines = 0;
+	struct tag_index *tags = rndr->tags;
+
+	/* the rest of the blocks being parsed: their index knows */
+	if (tags && data >= tags->data && data + size == tags->end &&
+		(tags->built > 0 || (!tags->built && index_closing_tags(rndr, tags))))
+		return find_closing_tag(tags, curtag, data, size, start_of_line);
+
+	while (i < size) {
+		i++;
+		while (i < size && !(data[i - 1] == '<' && data[i] == '/')) {
+			if (data[i] == '\n')
+				block_lines++;
+
+			i++;
+		}
+
+		/* If we are only looking for unindented tags, skip the tag
+		 * if it doesn't follow a newline.
+		 *
+		 * The only exception to this is if the tag is still on the
+		 * initial line; in that case it still counts as a closing
+		 * tag
+		 */
+		if (start_of_line && block_lines > 0 && data[i - 2] != '\n')
+			continue;
+
+		if (i + 2 + tag_size >= size)
+			break;
+
+		end_tag = htmlblock_end_tag(curtag, tag_size, rndr, data + i - 1, size - i + 1);
+		if (end_tag)
+			return i + end_tag - 1;
+	}
+
+	return 0;
+}
+
+
+/* parse_htmlblock • parsing of inline HTML block */
+static size_t
+parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, int do_render)
 {
 	size_t i, j = 0, tag_end;
 	const char *curtag = NULL;
-	struct buf work = { data, 0, 0, 0 };
+	struct buf work = { data, 0, 0, 0, BUF_GROW_UNIT, NULL };
 
 	/* identification of the opening tag */
 	if (size < 2 || data[0] != '<')
@@ -2192,8 +3210,8 @@ parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 
 			if (j) {
 				work.size = i + j;
-				if (do_render && rndr->cb.blockhtml)
-					rndr->cb.blockhtml(ob, &work, rndr->opaque);
+				if (do_render && rndr->parser->cb.blockhtml)
+					rndr->parser->cb.blockhtml(ob, &work, rndr->opaque);
 				return work.size;
 			}
 		}
@@ -2209,8 +3227,8 @@ parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 				j = is_empty(data + i, size - i);
 				if (j) {
 					work.size = i + j;
-					if (do_render && rndr->cb.blockhtml)
-						rndr->cb.blockhtml(ob, &work, rndr->opaque);
+					if (do_render && rndr->parser->cb.blockhtml)
+						rndr->parser->cb.blockhtml(ob, &work, rndr->opaque);
 					return work.size;
 				}
 			}
@@ -2235,12 +3253,65 @@ parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 
 	/* the end of the block has been found */
 	work.size = tag_end;
-	if (do_render && rndr->cb.blockhtml)
-		rndr->cb.blockhtml(ob, &work, rndr->opaque);
+	if (do_render && rndr->parser->cb.blockhtml)
+		rndr->parser->cb.blockhtml(ob, &work, rndr->opaque);
 
 	return tag_end;
 }
 
+/* table_cell: where a cell is, in its row */
+struct table_cell {
+	size_t beg, size;
+};
+
+/* table_split_row • cuts a row into at most columns cells, at every
+ * pipe, returning how many it had */
+static size_t
+table_split_row(const uint8_t *data, size_t size, size_t columns, struct table_cell *cells)
+{
+	const uint8_t *pipe;
+	size_t i = 0, col, end;
+
+	if (i < size && data[i] == '|')
+		i++;
+
+	for (col = 0; col < columns && i < size; ++col) {
+		while (i < size && _isspace(data[i]))
+			i++;
+
+		cells[col].beg = i;
+
+		pipe = memchr(data + i, '|', size - i);
+		i = pipe ? (size_t)(pipe - data) : size;
+
+		for (end = i; end > cells[col].beg && _isspace(data[end - 1]); end--);
+		cells[col].size = end - cells[col].beg;
+
+		i++;
+	}
+
+	return col;
+}
+
+/* parse_table_cell • parse_inline, going straight to the output for
+ * cells without any active character */
+static void
+parse_table_cell(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	if (redcarpet_scanner_find(&rndr->parser->scanner, data, size) < size) {
+		parse_inline(ob, rndr, data, size);
+		return;
+	}
+
+	if (!size || rndr->work_bufs[BUFFER_SPAN].size +
+		rndr->work_bufs[BUFFER_BLOCK].size > rndr->parser->max_nesting)
+		return;
+
+	/* out of budget or not, the cell comes out as it is */
+	rndr_spend(rndr, size);
+	rndr_plain(ob, rndr, data, size);
+}
+
 static void
 parse_table_row(
 	struct buf *ob,
@@ -2249,53 +3320,35 @@ parse_table_row(
 	size_t size,
 	size_t columns,
 	int *col_data,
-	int header_flag)
+	int header_flag,
+	struct table_cell *cells)
 {
-	size_t i = 0, col;
-	struct buf *row_work = 0;
+	size_t col, count;
+	struct buf *row_work = 0, *cell_work = 0;
 
-	if (!rndr->cb.table_cell || !rndr->cb.table_row)
+	if (!rndr->parser->cb.table_cell || !rndr->parser->cb.table_row)
 		return;
 
 	row_work = rndr_newbuf(rndr, BUFFER_SPAN);
+	cell_work = rndr_newbuf(rndr, BUFFER_SPAN);
 
-	if (i < size && data[i] == '|')
-		i++;
-
-	for (col = 0; col < columns && i < size; ++col) {
-		size_t cell_start, cell_end;
-		struct buf *cell_work;
-
-		cell_work = rndr_newbuf(rndr, BUFFER_SPAN);
+	count = table_split_row(data, size, columns, cells);
 
-		while (i < size && _isspace(data[i]))
-			i++;
-
-		cell_start = i;
-
-		while (i < size && data[i] != '|')
-			i++;
-
-		cell_end = i - 1;
-
-		while (cell_end > cell_start && _isspace(data[cell_end]))
-			cell_end--;
-
-		parse_inline(cell_work, rndr, data + cell_start, 1 + cell_end - cell_start);
-		rndr->cb.table_cell(row_work, cell_work, col_data[col] | header_flag, rndr->opaque);
-
-		rndr_popbuf(rndr, BUFFER_SPAN);
-		i++;
+	for (col = 0; col < count; ++col) {
+		cell_work->size = 0;
+		parse_table_cell(cell_work, rndr, data + cells[col].beg, cells[col].size);
+		rndr->parser->cb.table_cell(row_work, cell_work, col_data[col] | header_flag, rndr->opaque);
 	}
 
 	for (; col < columns; ++col) {
-		struct buf empty_cell = { 0, 0, 0, 0 };
-		rndr->cb.table_cell(row_work, &empty_cell, col_data[col] | header_flag, rndr->opaque);
+		struct buf empty_cell = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
+		rndr->parser->cb.table_cell(row_work, &empty_cell, col_data[col] | header_flag, rndr->opaque);
 	}
 
-	rndr->cb.table_row(ob, row_work, rndr->opaque);
+	rndr->parser->cb.table_row(ob, row_work, rndr->opaque);
 
 	rndr_popbuf(rndr, BUFFER_SPAN);
+	rndr_popbuf(rndr, BUFFER_SPAN);
 }
 
 static size_t
@@ -2305,10 +3358,17 @@ parse_table_header(
 	uint8_t *data,
 	size_t size,
 	size_t *columns,
-	int **column_data)
+	int **column_data,
+	struct table_cell **cells)
 {
 	int pipes;
 	size_t i = 0, col, header_end, under_end;
+	const uint8_t *eol;
+
+	/* a header is a whole line, with a pipe */
+	eol = memchr(data, '\n', size);
+	if (!eol || !memchr(data, '|', eol - data))
+		return 0;
 
 	pipes = 0;
 	while (i < size && data[i] != '\n')
@@ -2330,7 +3390,10 @@ parse_table_header(
 		pipes--;
 
 	*columns = pipes + 1;
-	*column_data = calloc(*columns, sizeof(int));
+	*column_data = redcarpet_arena_calloc(&rndr->arena, *columns, sizeof(int));
+	*cells = redcarpet_arena_alloc(&rndr->arena, *columns * sizeof(struct table_cell));
+	if (!*column_data || !*cells)
+		return 0;
 
 	/* Parse the header underline */
 	i++;
@@ -2381,7 +3444,8 @@ parse_table_header(
 		header_end,
 		*columns,
 		*column_data,
-		MKD_TABLE_HEADER
+		MKD_TABLE_HEADER,
+		*cells
 	);
 
 	return under_end + 1;
@@ -2395,115 +3459,183 @@ parse_table(
 	size_t size)
 {
 	size_t i;
+	const uint8_t *eol;
 
 	struct buf *header_work = 0;
 	struct buf *body_work = 0;
 
 	size_t columns;
 	int *col_data = NULL;
+	struct table_cell *cells = NULL;
 
 	header_work = rndr_newbuf(rndr, BUFFER_SPAN);
 	body_work = rndr_newbuf(rndr, BUFFER_BLOCK);
 
-	i = parse_table_header(header_work, rndr, data, size, &columns, &col_data);
+	i = parse_table_header(header_work, rndr, data, size, &columns, &col_data, &cells);
 	if (i > 0) {
 
+		/* rows go on for as long as lines have a pipe */
 		while (i < size) {
-			size_t row_start;
-			int pipes = 0;
-
-			row_start = i;
-
-			while (i < size && data[i] != '\n')
-				if (data[i++] == '|')
-					pipes++;
-
-			if (pipes == 0 || i == size) {
-				i = row_start;
+			eol = memchr(data + i, '\n', size - i);
+			if (!eol || !memchr(data + i, '|', eol - (data + i)))
 				break;
-			}
 
 			parse_table_row(
 				body_work,
 				rndr,
-				data + row_start,
-				i - row_start,
+				data + i,
+				eol - (data + i),
 				columns,
-				col_data, 0
+				col_data, 0,
+				cells
 			);
 
-			i++;
+			i = eol - data + 1;
 		}
 
-		if (rndr->cb.table)
-			rndr->cb.table(ob, header_work, body_work, rndr->opaque);
+		if (rndr->parser->cb.table)
+			rndr->parser->cb.table(ob, header_work, body_work, rndr->opaque);
 	}
 
-	free(col_data);
 	rndr_popbuf(rndr, BUFFER_SPAN);
 	rndr_popbuf(rndr, BUFFER_BLOCK);
 	return i;
 }
 
-/* parse_block • parsing of one block, returning next uint8_t to parse */
+/* rndr_flush_sink • moves top-level output into the rope. The last
+ * byte stays behind so that renderers testing `ob->size` before
+ * emitting a separator keep behaving as with a contiguous buffer */
 static void
-parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+rndr_flush_sink(struct buf *ob, struct sd_markdown *rndr)
 {
-	size_t beg, end, i;
-	uint8_t *txt_data;
-	beg = 0;
+	if (ob->size < rndr->sink->chunk_size)
+		return;
 
-	if (rndr->work_bufs[BUFFER_SPAN].size +
-		rndr->work_bufs[BUFFER_BLOCK].size > rndr->max_nesting)
+	if (redcarpet_rope_put(rndr->sink, ob->data, ob->size - 1) < 0)
 		return;
 
-	while (beg < size) {
-		txt_data = data + beg;
-		end = size - beg;
+	ob->data[0] = ob->data[ob->size - 1];
+	ob->size = 1;
+}
+
+/* parse_truncated • what is left of a block once the budget has run
+ * out, as a paragraph of plain text */
+static void
+parse_truncated(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	struct buf *work;
+	size_t i;
+
+	/* is_empty counts a newline past a blank last line */
+	while (size && (i = is_empty(data, size)) != 0) {
+		if (i > size)
+			i = size;
+		data += i;
+		size -= i;
+	}
+
+	while (size && (data[size - 1] == '\n' || data[size - 1] == ' '))
+		size--;
+
+	if (!size)
+		return;
+
+	work = rndr_newbuf(rndr, BUFFER_BLOCK);
+	rndr_plain(work, rndr, data, size);
+	if (rndr->parser->cb.paragraph)
+		rndr->parser->cb.paragraph(ob, work, rndr->opaque);
+	rndr_popbuf(rndr, BUFFER_BLOCK);
+}
 
-		if (is_atxheader(rndr, txt_data, end))
-			beg += parse_atxheader(ob, rndr, txt_data, end);
+/* parse_one_block • parsing of the block starting at data, returning
+ * how many bytes it took */
+static size_t
+parse_one_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	size_t i;
+	unsigned int kinds;
 
-		else if (data[beg] == '<' && rndr->cb.blockhtml &&
-				(i = parse_htmlblock(ob, rndr, txt_data, end, 1)) != 0)
-			beg += i;
+	if (!rndr_spend(rndr, 1)) {
+		parse_truncated(ob, rndr, data, size);
+		return size;
+	}
 
-		else if ((i = is_empty(txt_data, end)) != 0)
-			beg += i;
+	kinds = line_kinds(data, size);
 
-		else if (is_hrule(txt_data, end)) {
-			if (rndr->cb.hrule)
-				rndr->cb.hrule(ob, rndr->opaque);
+	if ((kinds & LINE_ATX) && is_atxheader(rndr, data, size))
+		return parse_atxheader(ob, rndr, data, size);
 
-			while (beg < size && data[beg] != '\n')
-				beg++;
+	if (data[0] == '<' && rndr->parser->cb.blockhtml &&
+			(i = parse_htmlblock(ob, rndr, data, size, 1)) != 0)
+		return i;
 
-			beg++;
-		}
+	if ((kinds & LINE_EMPTY) && (i = is_empty(data, size)) != 0)
+		return i;
 
-		else if ((rndr->ext_flags & MKDEXT_FENCED_CODE) != 0 &&
-			(i = parse_fencedcode(ob, rndr, txt_data, end)) != 0)
-			beg += i;
+	if ((kinds & LINE_HRULE) && is_hrule(data, size)) {
+		if (rndr->parser->cb.hrule)
+			rndr->parser->cb.hrule(ob, rndr->opaque);
 
-		else if ((rndr->ext_flags & MKDEXT_TABLES) != 0 &&
-			(i = parse_table(ob, rndr, txt_data, end)) != 0)
-			beg += i;
+		for (i = 0; i < size && data[i] != '\n'; i++);
+		return i + 1;
+	}
 
-		else if (prefix_quote(txt_data, end))
-			beg += parse_blockquote(ob, rndr, txt_data, end);
+	if ((rndr->parser->ext_flags & MKDEXT_FENCED_CODE) != 0 && (kinds & LINE_FENCE) &&
+		(i = parse_fencedcode(ob, rndr, data, size)) != 0)
+		return i;
 
-		else if (!(rndr->ext_flags & MKDEXT_DISABLE_INDENTED_CODE) && prefix_code(txt_data, end))
-			beg += parse_blockcode(ob, rndr, txt_data, end);
+	if ((rndr->parser->ext_flags & MKDEXT_TABLES) != 0 &&
+		(i = parse_table(ob, rndr, data, size)) != 0)
+		return i;
 
-		else if (prefix_uli(txt_data, end))
-			beg += parse_list(ob, rndr, txt_data, end, 0);
+	if ((kinds & LINE_QUOTE) && prefix_quote(data, size))
+		return parse_blockquote(ob, rndr, data, size);
 
-		else if (prefix_oli(txt_data, end))
-			beg += parse_list(ob, rndr, txt_data, end, MKD_LIST_ORDERED);
+	if (!(rndr->parser->ext_flags & MKDEXT_DISABLE_INDENTED_CODE) &&
+		(kinds & LINE_CODE) && prefix_code(data, size))
+		return parse_blockcode(ob, rndr, data, size);
 
-		else
-			beg += parse_paragraph(ob, rndr, txt_data, end);
+	if ((kinds & LINE_ULI) && prefix_uli(data, size))
+		return parse_list(ob, rndr, data, size, 0);
+
+	if ((kinds & LINE_OLI) && prefix_oli(data, size))
+		return parse_list(ob, rndr, data, size, MKD_LIST_ORDERED);
+
+	return parse_paragraph(ob, rndr, data, size);
+}
+
+/* parse_block • parsing of one block after another */
+static void
+parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	size_t beg = 0;
+	struct tag_index tags, *outer = rndr->tags;
+
+	if (rndr->work_bufs[BUFFER_SPAN].size +
+		rndr->work_bufs[BUFFER_BLOCK].size > rndr->parser->max_nesting)
+		return;
+
+	/* built on the first HTML block; blockquotes and list items get
+	 * compacted in place, but only before where the parsing is */
+	tags.data = data;
+	tags.end = data + size;
+	tags.built = 0;
+	rndr->tags = &tags;
+
+	while (beg < size) {
+		beg += parse_one_block(ob, rndr, data + beg, size - beg);
+
+		if (ob == rndr->sink_ob)
+			rndr_flush_sink(ob, rndr);
+	}
+
+	if (tags.built) {
+		sd_free(rndr->allocator, tags.groups);
+		sd_free(rndr->allocator, tags.closes);
+		sd_free(rndr->allocator, tags.bol);
 	}
+
+	rndr->tags = outer;
 }
 
 
@@ -2512,12 +3644,30 @@ parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
  * REFERENCE PARSING *
  *********************/
 
+/* bytes ending a line, or making it need normalization */
+static const uint8_t line_chars[256] = { ['\t'] = 1, ['\n'] = 1, ['\r'] = 1 };
+
+/* is_definition_candidate • whether a line can open a fence, a reference
+ * or a footnote definition: all of them start with a bracket, backtick
+ * or tilde after at most three spaces */
+static inline int
+is_definition_candidate(const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < 3 && i < size && data[i] == ' ')
+		i++;
+
+	return i < size && (data[i] == '[' || data[i] == '`' || data[i] == '~');
+}
+
 /* is_footnote • returns whether a line is a footnote definition or not */
 static int
-is_footnote(const uint8_t *data, size_t beg, size_t end, size_t *last, struct footnote_list *list)
+is_footnote(struct sd_markdown *rndr, const uint8_t *data, size_t beg, size_t end, size_t *last)
 {
 	size_t i = 0;
 	struct buf *contents = 0;
+	struct footnote_ref *ref;
 	size_t ind = 0;
 	int in_empty = 0;
 	size_t start = 0;
@@ -2549,7 +3699,7 @@ is_footnote(const uint8_t *data, size_t beg, size_t end, size_t *last, struct fo
 	i++;
 
 	/* getting content buffer */
-	contents = bufnew(64);
+	contents = rndr_newbuf(rndr, BUFFER_BLOCK);
 
 	start = i;
 
@@ -2602,24 +3752,21 @@ is_footnote(const uint8_t *data, size_t beg, size_t end, size_t *last, struct fo
 	if (last)
 		*last = start;
 
-	if (list) {
-		struct footnote_ref *ref;
-		ref = create_footnote_ref(list, data + id_offset, id_end - id_offset);
-		if (!ref)
-			return 0;
-		if (!add_footnote_ref(list, ref)) {
-			free_footnote_ref(ref);
-			return 0;
-		}
-		ref->contents = contents;
-	}
+	ref = create_footnote_ref(&rndr->arena, &rndr->footnotes_found, data + id_offset, id_end - id_offset);
+	if (ref)
+		ref->contents = arena_bufdup(&rndr->arena, contents->data, contents->size);
+
+	rndr_popbuf(rndr, BUFFER_BLOCK);
+
+	if (!ref || !ref->contents)
+		return 0;
 
 	return 1;
 }
 
 /* is_ref • returns whether a line is a reference or not */
 static int
-is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_ref **refs)
+is_ref(struct sd_markdown *rndr, const uint8_t *data, size_t beg, size_t end, size_t *last)
 {
 /*	int n; */
 	size_t i = 0;
@@ -2712,20 +3859,17 @@ is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_re
 	if (last)
 		*last = line_end;
 
-	if (refs) {
+	if (rndr) {
 		struct link_ref *ref;
 
-		ref = add_link_ref(refs, data + id_offset, id_end - id_offset);
+		ref = add_link_ref(&rndr->arena, &rndr->refs, data + id_offset, id_end - id_offset);
 		if (!ref)
 			return 0;
 
-		ref->link = bufnew(link_end - link_offset);
-		bufput(ref->link, data + link_offset, link_end - link_offset);
+		ref->link = arena_bufdup(&rndr->arena, data + link_offset, link_end - link_offset);
 
-		if (title_end > title_offset) {
-			ref->title = bufnew(title_end - title_offset);
-			bufput(ref->title, data + title_offset, title_end - title_offset);
-		}
+		if (title_end > title_offset)
+			ref->title = arena_bufdup(&rndr->arena, data + title_offset, title_end - title_offset);
 	}
 
 	return 1;
@@ -2760,176 +3904,1121 @@ static void expand_tabs(struct buf *ob, const uint8_t *line, size_t size)
  * EXPORTED FUNCTIONS *
  **********************/
 
+static void stream_reset(struct sd_markdown *md);
+static void render_blocks_parallel(struct buf *ob, struct buf *text, struct sd_markdown *md);
+
+/* markdown_context • a parser with a fresh state, configured by parser */
+static struct sd_markdown *
+markdown_context(const struct sd_parser *parser, void *opaque, const struct sd_allocator *allocator)
+{
+	struct sd_markdown *md = NULL;
+
+	md = sd_malloc(allocator, sizeof(struct sd_markdown));
+	if (!md)
+		return NULL;
+
+	md->parser = parser;
+	md->owns_parser = 0;
+	md->allocator = allocator;
+
+	redcarpet_stack_init(&md->work_bufs[BUFFER_BLOCK], 4, allocator);
+	redcarpet_stack_init(&md->work_bufs[BUFFER_SPAN], 8, allocator);
+	redcarpet_arena_init(&md->arena, 8192, allocator);
+
+	md->opaque = opaque;
+	md->in_link_body = 0;
+	md->sink = NULL;
+	md->sink_ob = NULL;
+	md->borrowed = NULL;
+	md->borrowed_size = 0;
+	md->borrowed_work = bufnew_allocator(64, BUF_GROW_DOUBLE, allocator);
+	md->tree = NULL;
+	md->tree_parser = NULL;
+	md->cache = NULL;
+	md->cache_seed = 0;
+	md->index = NULL;
+	md->threads = 1;
+	md->budget = 0;
+	md->work_left = 0;
+	md->truncated = 0;
+	md->span = NULL;
+	md->tags = NULL;
+
+	md->stream.pending = NULL;
+	md->stream.text = NULL;
+	md->stream.ob = NULL;
+	md->stream.html_open = NULL;
+	stream_reset(md);
+
+	return md;
+}
+
 struct sd_markdown *
 sd_markdown_new(
 	unsigned int extensions,
 	size_t max_nesting,
 	const struct sd_callbacks *callbacks,
-	void *opaque)
+	void *opaque,
+	const struct sd_allocator *allocator)
 {
+	struct sd_parser *parser = NULL;
 	struct sd_markdown *md = NULL;
 
 	assert(max_nesting > 0 && callbacks);
 
-	md = malloc(sizeof(struct sd_markdown));
-	if (!md)
+	parser = sd_malloc(allocator, sizeof(struct sd_parser));
+	if (!parser)
 		return NULL;
 
-	memcpy(&md->cb, callbacks, sizeof(struct sd_callbacks));
-
-	redcarpet_stack_init(&md->work_bufs[BUFFER_BLOCK], 4);
-	redcarpet_stack_init(&md->work_bufs[BUFFER_SPAN], 8);
+	memcpy(&parser->cb, callbacks, sizeof(struct sd_callbacks));
+	memset(parser->active_char, 0x0, 256);
 
-	memset(md->active_char, 0x0, 256);
-
-	if (md->cb.emphasis || md->cb.double_emphasis || md->cb.triple_emphasis) {
-		md->active_char['*'] = MD_CHAR_EMPHASIS;
-		md->active_char['_'] = MD_CHAR_EMPHASIS;
+	if (parser->cb.emphasis || parser->cb.double_emphasis || parser->cb.triple_emphasis) {
+		parser->active_char['*'] = MD_CHAR_EMPHASIS;
+		parser->active_char['_'] = MD_CHAR_EMPHASIS;
 
 		if (extensions & MKDEXT_STRIKETHROUGH)
-			md->active_char['~'] = MD_CHAR_EMPHASIS;
+			parser->active_char['~'] = MD_CHAR_EMPHASIS;
 		if (extensions & MKDEXT_HIGHLIGHT)
-			md->active_char['='] = MD_CHAR_EMPHASIS;
+			parser->active_char['='] = MD_CHAR_EMPHASIS;
 		if (extensions & MKDEXT_QUOTE)
-			md->active_char['"'] = MD_CHAR_QUOTE;
+			parser->active_char['"'] = MD_CHAR_QUOTE;
 	}
 
-	if (md->cb.codespan)
-		md->active_char['`'] = MD_CHAR_CODESPAN;
+	if (parser->cb.codespan)
+		parser->active_char['`'] = MD_CHAR_CODESPAN;
 
-	if (md->cb.linebreak)
-		md->active_char['\n'] = MD_CHAR_LINEBREAK;
+	if (parser->cb.linebreak)
+		parser->active_char['\n'] = MD_CHAR_LINEBREAK;
 
-	if (md->cb.image || md->cb.link)
-		md->active_char['['] = MD_CHAR_LINK;
+	if (parser->cb.image || parser->cb.link)
+		parser->active_char['['] = MD_CHAR_LINK;
 
-	md->active_char['<'] = MD_CHAR_LANGLE;
-	md->active_char['\\'] = MD_CHAR_ESCAPE;
-	md->active_char['&'] = MD_CHAR_ENTITITY;
+	parser->active_char['<'] = MD_CHAR_LANGLE;
+	parser->active_char['\\'] = MD_CHAR_ESCAPE;
+	parser->active_char['&'] = MD_CHAR_ENTITITY;
 
 	if (extensions & MKDEXT_AUTOLINK) {
-		md->active_char[':'] = MD_CHAR_AUTOLINK_URL;
-		md->active_char['@'] = MD_CHAR_AUTOLINK_EMAIL;
-		md->active_char['w'] = MD_CHAR_AUTOLINK_WWW;
+		parser->active_char[':'] = MD_CHAR_AUTOLINK_URL;
+		parser->active_char['@'] = MD_CHAR_AUTOLINK_EMAIL;
+		parser->active_char['w'] = MD_CHAR_AUTOLINK_WWW;
 	}
 
 	if (extensions & MKDEXT_SUPERSCRIPT)
-		md->active_char['^'] = MD_CHAR_SUPERSCRIPT;
+		parser->active_char['^'] = MD_CHAR_SUPERSCRIPT;
+
+	redcarpet_scanner_init(&parser->scanner, parser->active_char);
+	redcarpet_scanner_init(&parser->line_scanner, line_chars);
 
 	/* Extension data */
-	md->ext_flags = extensions;
-	md->opaque = opaque;
-	md->max_nesting = max_nesting;
-	md->in_link_body = 0;
+	parser->ext_flags = extensions;
+	parser->max_nesting = max_nesting;
+
+	md = markdown_context(parser, opaque, allocator);
+	if (!md) {
+		sd_free(allocator, parser);
+		return NULL;
+	}
 
+	md->owns_parser = 1;
 	return md;
 }
 
-void
-sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+struct sd_markdown *
+sd_markdown_fork(const struct sd_markdown *md, void *opaque, const struct sd_allocator *allocator)
 {
-#define MARKDOWN_GROW(x) ((x) + ((x) >> 1))
-	static const char UTF8_BOM[] = {0xEF, 0xBB, 0xBF};
-
-	struct buf *text;
-	size_t beg, end;
-	int in_fence = 0;
-	struct buf fence_delim = { 0, 0, 0, 0 };
+	struct sd_markdown *fork = markdown_context(md->parser, opaque, allocator);
 
-	text = bufnew(64);
-	if (!text)
-		return;
+	if (fork) {
+		fork->threads = md->threads;
+		fork->budget = md->budget;
+	}
 
-	/* Preallocate enough space for our buffer to avoid expanding while copying */
-	bufgrow(text, doc_size);
+	return fork;
+}
 
+/* render_begin • resets the state carried over a whole document */
+static void
+render_begin(struct sd_markdown *md)
+{
 	/* reset the references table */
-	memset(&md->refs, 0x0, REF_TABLE_SIZE * sizeof(void *));
+	memset(&md->refs, 0x0, sizeof(md->refs));
 
-	int footnotes_enabled  = md->ext_flags & MKDEXT_FOOTNOTES;
-	int codefences_enabled = md->ext_flags & MKDEXT_FENCED_CODE;
+	md->work_left = md->budget;
+	md->truncated = 0;
 
 	/* reset the footnotes lists */
-	if (footnotes_enabled) {
+	if (md->parser->ext_flags & MKDEXT_FOOTNOTES) {
 		memset(&md->footnotes_found, 0x0, sizeof(md->footnotes_found));
 		memset(&md->footnotes_used, 0x0, sizeof(md->footnotes_used));
 	}
+}
+
+/* render_first_pass • looking for references, copying everything else
+ * into text; the fence state is kept by the caller so that a document
+ * can go through it in several pieces */
+static void
+render_first_pass(struct buf *text, const uint8_t *document, size_t doc_size,
+	struct sd_markdown *md, int at_start, int *in_fence, struct buf *fence_delim)
+{
+	static const char UTF8_BOM[] = {0xEF, 0xBB, 0xBF};
+
+	size_t beg, end, run;
+	int has_tab;
+	int footnotes_enabled  = md->parser->ext_flags & MKDEXT_FOOTNOTES;
+	int codefences_enabled = md->parser->ext_flags & MKDEXT_FENCED_CODE;
 
-	/* first pass: looking for references, copying everything else */
 	beg = 0;
 
 	/* Skip a possible UTF-8 BOM, even though the Unicode standard
 	 * discourages having these in UTF-8 documents */
-	if (doc_size >= 3 && memcmp(document, UTF8_BOM, 3) == 0)
+	if (at_start && doc_size >= 3 && memcmp(document, UTF8_BOM, 3) == 0)
 		beg += 3;
 
-	while (beg < doc_size) { /* iterating over lines */
-		if (codefences_enabled && (is_codefence(document + beg, doc_size - beg, &fence_delim, NULL) != 0))
-			in_fence = !in_fence;
+	run = beg;
 
-		if (!in_fence && footnotes_enabled && is_footnote(document, beg, doc_size, &end, &md->footnotes_found))
-			beg = end;
-		else if (!in_fence && is_ref(document, beg, doc_size, &end, md->refs))
-			beg = end;
-		else { /* skipping to the next line */
-			end = beg;
-			while (end < doc_size && document[end] != '\n' && document[end] != '\r')
-				end++;
-
-			/* adding the line body if present */
-			if (end > beg)
-				expand_tabs(text, document + beg, end - beg);
-
-			while (end < doc_size && (document[end] == '\n' || document[end] == '\r')) {
-				/* add one \n per newline */
-				if (document[end] == '\n' || (end + 1 < doc_size && document[end + 1] != '\n'))
-					bufputc(text, '\n');
-				end++;
+	while (beg < doc_size) { /* iterating over lines */
+		if (is_definition_candidate(document + beg, doc_size - beg)) {
+			if (codefences_enabled && (is_codefence(document + beg, doc_size - beg, fence_delim, NULL) != 0))
+				*in_fence = !*in_fence;
+
+			if (!*in_fence && ((footnotes_enabled && is_footnote(md, document, beg, doc_size, &end)) ||
+				is_ref(md, document, beg, doc_size, &end))) {
+				bufput(text, document + run, beg - run);
+				beg = run = end;
+				continue;
 			}
+		}
 
-			beg = end;
+		/* skipping to the next line */
+		end = beg;
+		has_tab = 0;
+		while ((end += redcarpet_scanner_find(&md->parser->line_scanner, document + end, doc_size - end)) < doc_size &&
+			document[end] == '\t') {
+			has_tab = 1;
+			end++;
 		}
-	}
 
-	/* pre-grow the output buffer to minimize allocations */
-	bufgrow(ob, MARKDOWN_GROW(text->size));
+		/* lines needing no normalization are copied in runs */
+		if (!has_tab && (end == doc_size || document[end] == '\n')) {
+			beg = end < doc_size ? end + 1 : end;
+			continue;
+		}
 
-	/* second pass: actual rendering */
-	if (md->cb.doc_header)
-		md->cb.doc_header(ob, md->opaque);
+		bufput(text, document + run, beg - run);
 
-	if (text->size) {
-		/* adding a final newline if not already present */
-		if (text->data[text->size - 1] != '\n' && text->data[text->size - 1] != '\r')
+		/* adding the line body if present */
+		if (end > beg)
+			expand_tabs(text, document + beg, end - beg);
+
+		while (end < doc_size && (document[end] == '\n' || document[end] == '\r')) {
+			/* add one \n per newline */
+			if (document[end] == '\n' || (end + 1 < doc_size && document[end + 1] != '\n'))
+				bufputc(text, '\n');
+			end++;
+		}
+
+		beg = run = end;
+	}
+
+	bufput(text, document + run, beg - run);
+}
+
+/* render_blocks • second pass: actual rendering of the text */
+static void
+render_blocks(struct buf *ob, struct buf *text, struct sd_markdown *md)
+{
+	if (text->size) {
+		/* adding a final newline if not already present */
+		if (text->data[text->size - 1] != '\n' && text->data[text->size - 1] != '\r')
 			bufputc(text, '\n');
 
 		parse_block(ob, md, text->data, text->size);
 	}
+}
 
+/* render_end • closing of the document, and release of everything
+ * it allocated */
+static void
+render_end(struct buf *ob, struct sd_markdown *md)
+{
 	/* footnotes */
-	if (footnotes_enabled)
+	if (md->parser->ext_flags & MKDEXT_FOOTNOTES)
 		parse_footnote_list(ob, md, &md->footnotes_used);
 
-	if (md->cb.doc_footer)
-		md->cb.doc_footer(ob, md->opaque);
+	if (md->parser->cb.doc_footer)
+		md->parser->cb.doc_footer(ob, md->opaque);
+
+	/* clean-up: references, footnotes and the text all live in the arena */
+	redcarpet_arena_reset(&md->arena);
+
+	assert(md->work_bufs[BUFFER_SPAN].size == 0);
+	assert(md->work_bufs[BUFFER_BLOCK].size == 0);
+}
+
+/* render_text • first pass over a whole document, into a text buffer
+ * taken from the render's arena */
+static int
+render_text(struct buf *text, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	const uint8_t *tab;
+	int in_fence = 0;
+	struct buf fence_delim = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
+
+	/* The first pass only grows the document by expanding tabs (at most
+	 * three extra bytes each) and by adding a final newline, so the text
+	 * buffer can be sized upfront */
+	text->asize = doc_size + 1;
+	for (tab = document; (tab = memchr(tab, '\t', document + doc_size - tab)) != NULL; ++tab)
+		text->asize += 3;
+
+	text->data = redcarpet_arena_alloc(&md->arena, text->asize);
+	if (!text->data)
+		return 0;
+
+	/* first pass: looking for references, copying everything else */
+	render_first_pass(text, document, doc_size, md, 1, &in_fence, &fence_delim);
+	return 1;
+}
+
+/* is_clean_document • whether the first pass would leave the document
+ * as it is: no BOM, tabs, CRs nor anything looking like a reference or
+ * footnote definition, and already ending with a newline */
+static int
+is_clean_document(const uint8_t *document, size_t doc_size)
+{
+	const uint8_t *end = document + doc_size, *p, *line;
+
+	if (doc_size == 0 || document[doc_size - 1] != '\n')
+		return 0;
+
+	if (doc_size >= 3 && document[0] == 0xEF && document[1] == 0xBB && document[2] == 0xBF)
+		return 0;
+
+	if (memchr(document, '\t', doc_size) || memchr(document, '\r', doc_size))
+		return 0;
+
+	/* a definition opens with a bracket after at most three spaces */
+	for (p = document; (p = memchr(p, '[', end - p)) != NULL; ++p) {
+		line = p;
+		while (line > document && p - line < 3 && line[-1] == ' ')
+			line--;
+
+		if (line == document || line[-1] == '\n')
+			return 0;
+	}
+
+	return 1;
+}
+
+static void
+markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+#define MARKDOWN_GROW(x) ((x) + ((x) >> 1))
+	struct buf text_buf = { 0, 0, 0, 64, BUF_GROW_UNIT, NULL };
+	struct buf *text = &text_buf;
+
+	/* a one-shot render drops any unfinished stream */
+	stream_reset(md);
+
+	render_begin(md);
+
+	if (md->borrowed_work && is_clean_document(document, doc_size)) {
+		/* nothing for the first pass to do: the blocks are parsed
+		 * straight from the caller's buffer */
+		text->data = (uint8_t *)document;
+		text->size = doc_size;
+		md->borrowed = document;
+		md->borrowed_size = doc_size;
+	} else if (!render_text(text, document, doc_size, md))
+		return;
+
+	/* pre-grow the output buffer to minimize allocations; when
+	 * rendering to a rope it only ever holds about one chunk */
+	if (md->sink)
+		bufgrow(ob, md->sink->chunk_size * 2);
+	else
+		bufgrow(ob, MARKDOWN_GROW(text->size));
+
+	/* second pass: actual rendering */
+	if (md->parser->cb.doc_header)
+		md->parser->cb.doc_header(ob, md->opaque);
+
+	/* the chunks of a parallel render can't share out a budget */
+	if (md->threads > 1 && !md->sink && !md->budget)
+		render_blocks_parallel(ob, text, md);
+	else
+		render_blocks(ob, text, md);
+	render_end(ob, md);
+
+	md->borrowed = NULL;
+	md->borrowed_size = 0;
+}
+
+void
+sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	uint64_t key = 0;
+	size_t start = ob->size;
+
+	if (md->cache) {
+		key = redcarpet_cache_hash(document, doc_size, md->cache_seed ^ md->budget);
+		if (redcarpet_cache_get(md->cache, key, document, doc_size, ob)) {
+			md->truncated = 0;
+			bufcstr(ob);
+			return;
+		}
+	}
+
+	markdown_render(ob, document, doc_size, md);
+
+	/* a truncated render doesn't make it to the cache; an empty one may
+	 * have left ob without any data */
+	if (md->cache && !md->truncated)
+		redcarpet_cache_put(md->cache, key, document, doc_size,
+			ob->size > start ? ob->data + start : NULL, ob->size - start);
 
 	/* Null-terminate the buffer */
 	bufcstr(ob);
+}
 
-	/* clean-up */
-	bufrelease(text);
-	free_link_refs(md->refs);
-	if (footnotes_enabled) {
-		free_footnote_list(&md->footnotes_found, 1);
-		free_footnote_list(&md->footnotes_used, 0);
+int
+sd_markdown_cache(struct sd_markdown *md, size_t budget, uint64_t seed)
+{
+	redcarpet_cache_free(md->cache);
+	md->cache = NULL;
+
+	if (!budget)
+		return 1;
+
+	md->cache = redcarpet_cache_new(budget, md->allocator);
+	md->cache_seed = seed ^ ((uint64_t)md->parser->ext_flags << 32);
+	return md->cache != NULL;
+}
+
+const struct render_cache *
+sd_markdown_get_cache(const struct sd_markdown *md)
+{
+	return md->cache;
+}
+
+int
+sd_markdown_render_rope(struct rope *rope, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	struct buf *ob;
+	int err;
+
+	ob = bufnew_allocator(64, BUF_GROW_DOUBLE, md->allocator);
+	if (!ob)
+		return BUF_ENOMEM;
+
+	md->sink = rope;
+	md->sink_ob = ob;
+
+	markdown_render(ob, document, doc_size, md);
+
+	md->sink = NULL;
+	md->sink_ob = NULL;
+
+	err = redcarpet_rope_put(rope, ob->data, ob->size);
+	bufrelease(ob);
+
+	return err;
+}
+
+struct sd_tree *
+sd_markdown_parse(const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	struct buf text_buf = { 0, 0, 0, 64, BUF_GROW_UNIT, NULL };
+	struct buf *text = &text_buf, *ob;
+	const struct sd_parser *parser = md->parser;
+	struct sd_parser recorder;
+	struct sd_tree *tree;
+	void *opaque;
+	int ok;
+
+	tree = redcarpet_tree_new(md->allocator);
+	if (!tree)
+		return NULL;
+
+	ob = bufnew_allocator(256, BUF_GROW_DOUBLE, md->allocator);
+	if (!ob) {
+		sd_tree_free(tree);
+		return NULL;
 	}
 
-	assert(md->work_bufs[BUFFER_SPAN].size == 0);
-	assert(md->work_bufs[BUFFER_BLOCK].size == 0);
+	stream_reset(md);
+
+	/* the recorder stands in for every callback the renderer has, so
+	 * the active characters stay the same */
+	memcpy(&recorder, parser, sizeof(struct sd_parser));
+	redcarpet_tree_callbacks(&recorder.cb, &parser->cb);
+	opaque = md->opaque;
+
+	/* spans the renderer would decline are left to the parser */
+	redcarpet_tree_renderer(tree, &parser->cb, opaque);
+
+	md->parser = &recorder;
+	md->opaque = tree;
+	md->tree = tree;
+	md->tree_parser = parser;
+
+	render_begin(md);
+
+	ok = render_text(text, document, doc_size, md);
+	if (ok && text->size && text->data[text->size - 1] != '\n')
+		bufputc(text, '\n');
+
+	/* the nodes point into the tree's own copy of the text */
+	if (ok && (ok = redcarpet_tree_set_text(tree, text->data, text->size)) && tree->text_size)
+		parse_block(ob, md, tree->text, tree->text_size);
+
+	render_end(ob, md);
+	tree->nodes = redcarpet_tree_nodes(tree, ob);
+
+	md->parser = parser;
+	md->opaque = opaque;
+	md->tree = NULL;
+	redcarpet_tree_renderer(tree, NULL, NULL);
+
+	bufrelease(ob);
+
+	if (!ok) {
+		sd_tree_free(tree);
+		return NULL;
+	}
+
+	return tree;
 }
 
-void
-sd_markdown_free(struct sd_markdown *md)
+
+
+/*************************
+ * INCREMENTAL RENDERING *
+ *************************/
+
+/* An incremental render keeps every top-level block of the previous one,
+ * with where it ends in the text and in the output. A block only depends
+ * on the text from its start on, and where it ends only on the text up
+ * to the first line of the next one. So after an edit, the blocks are
+ * parsed again from the one before the edit on, until one of them ends
+ * where an old block ended, past the edit: from there on the old output
+ * is still good.
+ *
+ * An HTML block can reach for its closing tag much further, so an edit
+ * on or right after a line with a '<' gets a full render. So does any
+ * change in the reference definitions, and any document with footnotes,
+ * which are numbered over the whole of it. */
+
+static void
+index_free(const struct sd_allocator *allocator, struct block_index *index)
+{
+	if (!index)
+		return;
+
+	bufrelease(index->text);
+	bufrelease(index->output);
+	sd_free(allocator, index->blocks);
+	sd_free(allocator, index);
+}
+
+static struct block_index *
+index_new(const struct sd_allocator *allocator)
+{
+	struct block_index *index = sd_malloc(allocator, sizeof(struct block_index));
+
+	if (!index)
+		return NULL;
+
+	memset(index, 0x0, sizeof(struct block_index));
+	index->text = bufnew_allocator(1024, BUF_GROW_DOUBLE, allocator);
+	index->output = bufnew_allocator(1024, BUF_GROW_DOUBLE, allocator);
+
+	if (!index->text || !index->output) {
+		index_free(allocator, index);
+		return NULL;
+	}
+
+	return index;
+}
+
+/* index_push • appends a block to a list of them, 0 when out of memory */
+static int
+index_push(const struct sd_allocator *allocator, struct block_span **blocks,
+	size_t *count, size_t *asize, size_t end, size_t out_end, int empty)
+{
+	struct block_span *grown;
+
+	if (*count == *asize) {
+		grown = sd_realloc(allocator, *blocks,
+			(*asize ? *asize * 2 : 64) * sizeof(struct block_span));
+		if (!grown)
+			return 0;
+
+		*blocks = grown;
+		*asize = *asize ? *asize * 2 : 64;
+	}
+
+	(*blocks)[*count].end = end;
+	(*blocks)[*count].out_end = out_end;
+	(*blocks)[*count].empty = empty;
+	(*count)++;
+	return 1;
+}
+
+/* index_block • renders the block at beg, returning where it ends */
+static size_t
+index_block(struct buf *ob, struct sd_markdown *md, const struct buf *text, size_t beg, int *empty)
+{
+	size_t end;
+
+	*empty = is_empty(text->data + beg, text->size - beg) != 0;
+	end = beg + parse_one_block(ob, md, text->data + beg, text->size - beg);
+	return end < text->size ? end : text->size;
+}
+
+/* refs_fingerprint • a digest of the reference definitions, whichever
+ * order they come in, and of how many footnotes there are */
+static uint64_t
+refs_fingerprint(const struct sd_markdown *md)
+{
+	const struct link_ref *ref;
+	uint64_t sum = md->refs.count, h;
+	size_t i;
+
+	if (md->parser->ext_flags & MKDEXT_FOOTNOTES)
+		sum ^= (uint64_t)md->footnotes_found.count << 32;
+
+	for (i = 0; i < md->refs.size; ++i) {
+		ref = (const struct link_ref *)md->refs.slots[i];
+		if (!ref)
+			continue;
+
+		h = redcarpet_cache_hash(ref->key.name, ref->key.name_size, ref->key.id);
+		if (ref->link)
+			h = redcarpet_cache_hash(ref->link->data, ref->link->size, h);
+		if (ref->title)
+			h = redcarpet_cache_hash(ref->title->data, ref->title->size, h ^ 1);
+		sum += h;
+	}
+
+	return sum;
+}
+
+/* index_render • full render of text, keeping its blocks in the index */
+static void
+index_render(struct buf *ob, struct sd_markdown *md, struct block_index *index, struct buf *text)
+{
+	size_t start = ob->size, beg = 0;
+	int empty, ok = 1;
+
+	if (md->parser->cb.doc_header)
+		md->parser->cb.doc_header(ob, md->opaque);
+
+	index->count = 0;
+	index->out_begin = ob->size - start;
+	index->empty_start = (start == 0);
+
+	/* the blocks get compacted in place: keep the text as it is first */
+	index->text->size = 0;
+	bufput(index->text, text->data, text->size);
+
+	while (beg < text->size) {
+		beg = index_block(ob, md, text, beg, &empty);
+		ok = ok && index_push(md->allocator, &index->blocks, &index->count,
+			&index->asize, beg, ob->size - start, empty);
+	}
+
+	render_end(ob, md);
+
+	index->output->size = 0;
+	bufput(index->output, ob->data + start, ob->size - start);
+	index->valid = ok && index->text->size == text->size &&
+		index->output->size == ob->size - start;
+}
+
+/* index_has_tag • whether the lines from beg up to end have a '<' */
+static int
+index_has_tag(const struct buf *text, size_t beg, size_t end)
+{
+	while (end < text->size && text->data[end] != '\n')
+		end++;
+
+	return end > beg && memchr(text->data + beg, '<', end - beg) != NULL;
+}
+
+/* index_splice • renders text again from the block before the edit to
+ * the first block which ends as an old one did, and splices the result
+ * into the old output; returns 0 when that can't be done */
+static int
+index_splice(struct buf *ob, struct sd_markdown *md, struct block_index *index, struct buf *text)
+{
+	const struct buf *old = index->text;
+	struct block_span *blocks = NULL;
+	size_t count = 0, asize = 0, start = ob->size, old_size = old->size;
+	size_t prefix = 0, suffix = 0, min, line, beg, k, j, lo, hi, i, old_pos, out_j;
+	int empty, ok = 1;
+
+	min = old->size < text->size ? old->size : text->size;
+	while (prefix < min && old->data[prefix] == text->data[prefix])
+		prefix++;
+	while (suffix < min - prefix &&
+		old->data[old->size - suffix - 1] == text->data[text->size - suffix - 1])
+		suffix++;
+
+	if (prefix == old->size && prefix == text->size) {
+		bufput(ob, index->output->data, index->output->size);
+		redcarpet_arena_reset(&md->arena);
+		return 1;
+	}
+
+	/* the edit starts on this line, or the one after */
+	line = prefix;
+	while (line > 0 && text->data[line - 1] != '\n')
+		line--;
+	if (line > 0)
+		line--;
+	while (line > 0 && text->data[line - 1] != '\n')
+		line--;
+
+	if (index_has_tag(old, line, old->size - suffix) ||
+		index_has_tag(text, line, text->size - suffix))
+		return 0;
+
+	/* the block holding that line, and the one before it */
+	for (k = 0; k < index->count && index->blocks[k].end <= line; k++);
+	if (k > 0)
+		k--;
+	while (k > 0 && index->blocks[k].empty)
+		k--;
+
+	/* the old blocks and output up to block k stay as they are */
+	for (i = 0; i < k && ok; ++i)
+		ok = index_push(md->allocator, &blocks, &count, &asize,
+			index->blocks[i].end, index->blocks[i].out_end, index->blocks[i].empty);
+
+	bufput(ob, index->output->data, k ? index->blocks[k - 1].out_end : index->out_begin);
+
+	/* from here on, only the size of the old text matters */
+	index->text->size = 0;
+	bufput(index->text, text->data, text->size);
+	beg = k ? index->blocks[k - 1].end : 0;
+
+	for (;;) {
+		if (beg < text->size) {
+			beg = index_block(ob, md, text, beg, &empty);
+			ok = ok && index_push(md->allocator, &blocks, &count, &asize,
+				beg, ob->size - start, empty);
+		}
+
+		if (beg < text->size - suffix)
+			continue;
+
+		/* past the edit: does an old block start here too? */
+		old_pos = beg - text->size + old_size;
+		if (old_pos == old_size) {
+			j = index->count;
+			break;
+		}
+
+		lo = 0;
+		hi = index->count;
+		while (lo < hi) {
+			i = lo + (hi - lo) / 2;
+			if (index->blocks[i].end < old_pos)
+				lo = i + 1;
+			else
+				hi = i;
+		}
+
+		/* the HTML renderer starts most blocks with a newline,
+		 * unless they come first in the output */
+		if (lo < index->count && index->blocks[lo].end == old_pos &&
+			(index->empty_start && index->blocks[lo].out_end == 0) == (ob->size == 0)) {
+			j = lo + 1;
+			break;
+		}
+	}
+
+	/* and so do the ones from block j on, moved around */
+	out_j = j ? index->blocks[j - 1].out_end : index->out_begin;
+
+	for (i = j; i < index->count && ok; ++i)
+		ok = index_push(md->allocator, &blocks, &count, &asize,
+			index->blocks[i].end - old_size + text->size,
+			index->blocks[i].out_end - out_j + (ob->size - start),
+			index->blocks[i].empty);
+
+	bufput(ob, index->output->data + out_j, index->output->size - out_j);
+
+	sd_free(md->allocator, index->blocks);
+	index->blocks = blocks;
+	index->count = count;
+	index->asize = asize;
+
+	index->output->size = 0;
+	bufput(index->output, ob->data + start, ob->size - start);
+	index->valid = ok && index->text->size == text->size &&
+		index->output->size == ob->size - start;
+
+	/* no footer: it came along with the old output */
+	redcarpet_arena_reset(&md->arena);
+	return 1;
+}
+
+int
+sd_markdown_render_incremental(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	struct buf text_buf = { 0, 0, 0, 64, BUF_GROW_UNIT, NULL };
+	struct buf *text = &text_buf;
+	uint64_t refs;
+	int spliced = 0;
+
+	if (!md->index && (md->index = index_new(md->allocator)) == NULL) {
+		sd_markdown_render(ob, document, doc_size, md);
+		return 0;
+	}
+
+	stream_reset(md);
+	render_begin(md);
+
+	if (!render_text(text, document, doc_size, md))
+		return 0;
+
+	if (text->size && text->data[text->size - 1] != '\n' && text->data[text->size - 1] != '\r')
+		bufputc(text, '\n');
+
+	refs = refs_fingerprint(md);
+
+	if (md->index->valid && md->index->refs == refs &&
+		(!(md->parser->ext_flags & MKDEXT_FOOTNOTES) || md->footnotes_found.count == 0) &&
+		md->index->empty_start == (ob->size == 0))
+		spliced = index_splice(ob, md, md->index, text);
+
+	if (!spliced)
+		index_render(ob, md, md->index, text);
+
+	md->index->refs = refs;
+
+	/* output cut short by the budget can't be spliced into */
+	if (md->truncated)
+		md->index->valid = 0;
+
+	/* Null-terminate the buffer */
+	bufcstr(ob);
+	return spliced;
+}
+
+
+
+/*************
+ * STREAMING *
+ *************/
+
+/* A stream is rendered in segments, cut at the start of an unindented
+ * line beginning with a letter that follows an empty line. Every block
+ * ends there, so both sides parse the same as in the whole document,
+ * as long as the cut is not inside a fenced code block nor inside an
+ * HTML block whose closing tag hasn't been read yet.
+ *
+ * Input goes through the first pass up to the last such line seen so
+ * far: this is where neither reference nor footnote definitions can
+ * reach past. References must therefore be defined before the
+ * segment using them is cut, or they are left unresolved. */
+
+/* is_line_blank • whether a raw, unexpanded line is empty */
+static int
+is_line_blank(const uint8_t *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size && data[i] != '\n'; i++)
+		if (data[i] != ' ' && data[i] != '\t' && data[i] != '\r')
+			return 0;
+
+	return 1;
+}
+
+/* htmlblock_settled • whether more input could still change where the
+ * HTML block starting at data ends; a line that won't start a block at
+ * all is settled right away */
+static int
+htmlblock_settled(struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	size_t i;
+	const char *curtag;
+
+	i = 1;
+	while (i < size && data[i] != '>' && data[i] != ' ')
+		i++;
+
+	if (i >= size)
+		return 0;
+
+	curtag = find_block_tag((char *)data + 1, (int)i - 1);
+	if (curtag)
+		return htmlblock_end(curtag, rndr, data, size, 1) != 0;
+
+	/* HTML comment, laxist form */
+	if (size > 5 && data[1] == '!' && data[2] == '-' && data[3] == '-') {
+		i = 5;
+		while (i < size && !(data[i - 2] == '-' && data[i - 1] == '-' && data[i] == '>'))
+			i++;
+
+		return i + 1 < size;
+	}
+
+	/* HR */
+	if (size > 4 && (data[1] == 'h' || data[1] == 'H') && (data[2] == 'r' || data[2] == 'R')) {
+		i = 3;
+		while (i < size && data[i] != '>')
+			i++;
+
+		return i + 1 < size;
+	}
+
+	return 1;
+}
+
+/* stream_track • follows fenced code and possible HTML blocks over
+ * the text not looked at yet */
+static void
+stream_track(struct sd_markdown *md, struct sd_stream *st)
+{
+	uint8_t *data = st->text->data;
+	size_t size = st->text->size;
+	size_t beg, end;
+	struct buf delim = { &st->fence_char, 0, 0, 0, BUF_GROW_UNIT, NULL };
+
+	for (beg = st->tracked; beg < size; beg = end) {
+		for (end = beg; end < size && data[end] != '\n'; end++);
+		if (end < size)
+			end++;
+
+		delim.size = st->fence_size;
+		if ((md->parser->ext_flags & MKDEXT_FENCED_CODE) &&
+			is_codefence(data + beg, end - beg, &delim, NULL) != 0) {
+			/* only a fence following an empty line surely opens a
+			 * block; other ones may belong to a paragraph or to a
+			 * list item, and then nothing tells where code ends */
+			if (!st->fence_size && !st->prev_blank)
+				st->fence_lost = 1;
+
+			st->fence_char = delim.size ? delim.data[0] : 0;
+			st->fence_size = delim.size;
+			delim.data = &st->fence_char;
+		}
+
+		/* every line starting with a tag may start an HTML block,
+		 * even inside another one: that may well be in a list item */
+		if (!st->fence_size && data[beg] == '<' && md->parser->cb.blockhtml) {
+			bufput(st->html_open, &beg, sizeof(size_t));
+			st->html_retry = 1;
+		}
+		else if (st->html_open->size && memchr(data + beg, '>', end - beg))
+			st->html_retry = 1;
+
+		st->prev_blank = is_empty(data + beg, end - beg) != 0;
+	}
+
+	st->tracked = size;
+}
+
+/* stream_can_cut • whether the text can be cut at its current end */
+static int
+stream_can_cut(struct sd_markdown *md, struct sd_stream *st)
+{
+	size_t *open, i, n, left = 0;
+
+	stream_track(md, st);
+
+	if (st->html_open->size && st->html_retry) {
+		open = (size_t *)st->html_open->data;
+		n = st->html_open->size / sizeof(size_t);
+
+		for (i = 0; i < n; ++i) {
+			if (!htmlblock_settled(md, st->text->data + open[i], st->text->size - open[i]))
+				open[left++] = open[i];
+		}
+
+		st->html_open->size = left * sizeof(size_t);
+		st->html_retry = 0;
+	}
+
+	return !st->html_open->size && !st->fence_size && !st->fence_lost;
+}
+
+/* stream_flush • hands the rendered output over to the caller,
+ * keeping the last byte like the rope sink does */
+static void
+stream_flush(struct buf *ob, struct sd_markdown *md)
+{
+	struct buf *out = md->stream.ob;
+
+	if (out->size <= 1)
+		return;
+
+	bufput(ob, out->data, out->size - 1);
+	out->data[0] = out->data[out->size - 1];
+	out->size = 1;
+}
+
+static void
+stream_reset(struct sd_markdown *md)
+{
+	struct sd_stream *st = &md->stream;
+
+	if (st->pending) st->pending->size = 0;
+	if (st->text) st->text->size = 0;
+	if (st->ob) st->ob->size = 0;
+	if (st->html_open) st->html_open->size = 0;
+
+	st->active = 0;
+	st->at_start = 1;
+	st->scanned = 0;
+	st->raw_blank = 1;
+	st->in_fence = 0;
+	st->fence_delim.data = NULL;
+	st->fence_delim.size = 0;
+
+	st->tracked = 0;
+	st->cut = 0;
+	st->prev_blank = 1;
+	st->fence_char = 0;
+	st->fence_size = 0;
+	st->fence_lost = 0;
+	st->html_retry = 0;
+}
+
+static int
+stream_open(struct sd_markdown *md)
+{
+	struct sd_stream *st = &md->stream;
+
+	if (!st->pending)
+		st->pending = bufnew_allocator(1024, BUF_GROW_DOUBLE, md->allocator);
+	if (!st->text)
+		st->text = bufnew_allocator(1024, BUF_GROW_DOUBLE, md->allocator);
+	if (!st->ob)
+		st->ob = bufnew_allocator(1024, BUF_GROW_DOUBLE, md->allocator);
+	if (!st->html_open)
+		st->html_open = bufnew_allocator(64, BUF_GROW_DOUBLE, md->allocator);
+
+	if (!st->pending || !st->text || !st->ob || !st->html_open)
+		return BUF_ENOMEM;
+
+	stream_reset(md);
+	st->active = 1;
+
+	render_begin(md);
+
+	if (md->parser->cb.doc_header)
+		md->parser->cb.doc_header(st->ob, md->opaque);
+
+	return BUF_OK;
+}
+
+/* stream_first_pass • moves raw input through the first pass */
+static void
+stream_first_pass(struct sd_markdown *md, const uint8_t *data, size_t size)
+{
+	struct sd_stream *st = &md->stream;
+
+	render_first_pass(st->text, data, size, md,
+		st->at_start, &st->in_fence, &st->fence_delim);
+
+	/* the delimiter points into the raw input, which is about to move */
+	if (st->fence_delim.size) {
+		st->fence_delim_char = st->fence_delim.data[0];
+		st->fence_delim.data = &st->fence_delim_char;
+	}
+
+	st->at_start = 0;
+}
+
+int
+sd_markdown_feed(struct buf *ob, const uint8_t *data, size_t size, struct sd_markdown *md)
+{
+	struct sd_stream *st = &md->stream;
+	const uint8_t *raw, *eol;
+	size_t beg, end, base = 0;
+	size_t *open, i;
+
+	if (!st->active && stream_open(md) < 0)
+		return BUF_ENOMEM;
+
+	if (bufgrow(st->pending, st->pending->size + size) < 0)
+		return BUF_ENOMEM;
+
+	bufput(st->pending, data, size);
+	raw = st->pending->data;
+
+	/* looking at every complete line not seen yet for a place to cut */
+	for (beg = st->scanned;
+		(eol = memchr(raw + beg, '\n', st->pending->size - beg)) != NULL;
+		beg = end) {
+		end = eol - raw + 1;
+
+		if (st->raw_blank && ((raw[beg] | 0x20) >= 'a' && (raw[beg] | 0x20) <= 'z')) {
+			stream_first_pass(md, raw + base, beg - base);
+			base = beg;
+
+			if (stream_can_cut(md, st))
+				st->cut = st->text->size;
+		}
+
+		st->raw_blank = is_line_blank(raw + beg, end - beg);
+	}
+
+	/* dropping the input that went through the first pass */
+	memmove(st->pending->data, raw + base, st->pending->size - base);
+	st->pending->size -= base;
+	st->scanned = beg - base;
+
+	if (st->cut) {
+		parse_block(st->ob, md, st->text->data, st->cut);
+
+		memmove(st->text->data, st->text->data + st->cut, st->text->size - st->cut);
+		st->text->size -= st->cut;
+		st->tracked -= st->cut;
+
+		/* blocks opened after the cut, while looking for a later one */
+		open = (size_t *)st->html_open->data;
+		for (i = 0; i < st->html_open->size / sizeof(size_t); ++i)
+			open[i] -= st->cut;
+
+		st->cut = 0;
+	}
+
+	stream_flush(ob, md);
+	return BUF_OK;
+}
+
+int
+sd_markdown_finish(struct buf *ob, struct sd_markdown *md)
+{
+	struct sd_stream *st = &md->stream;
+
+	if (!st->active && stream_open(md) < 0)
+		return BUF_ENOMEM;
+
+	stream_first_pass(md, st->pending->data, st->pending->size);
+	st->pending->size = 0;
+
+	render_blocks(st->ob, st->text, md);
+	render_end(st->ob, md);
+
+	bufput(ob, st->ob->data, st->ob->size);
+	stream_reset(md);
+
+	/* Null-terminate the buffer */
+	bufcstr(ob);
+	return BUF_OK;
+}
+
+/* release_work_bufs • frees the work buffers of a parser */
+static void
+release_work_bufs(struct sd_markdown *md)
 {
 	size_t i;
 
@@ -2941,6 +5030,455 @@ sd_markdown_free(struct sd_markdown *md)
 
 	redcarpet_stack_free(&md->work_bufs[BUFFER_SPAN]);
 	redcarpet_stack_free(&md->work_bufs[BUFFER_BLOCK]);
+}
+
+/**********************
+ * PARALLEL RENDERING *
+ **********************/
+
+/* A large document is cut at the same places as a stream is, into
+ * chunks rendered side by side by copies of the parser, each with its
+ * own work buffers and its own copy of the text to compact blocks in.
+ * The copies only read the reference and footnote tables: a chunk
+ * using footnotes, which are numbered as they are first used, is left
+ * for the end, when the outputs are put together in order.
+ *
+ * The callbacks are then called from several threads at once. */
+
+#define PARALLEL_MIN_CHUNK (64 * 1024)
+
+#ifdef HAVE_PTHREAD_H
+
+struct parallel_chunk {
+	size_t beg, end;	/* in the text */
+	struct buf *ob;	/* NULL when left for the end */
+	int follows;	/* rendered as if some output came before */
+	int deferred;	/* uses footnotes */
+};
+
+struct parallel_job {
+	struct sd_markdown *md;
+	const struct buf *text;
+	struct parallel_chunk *chunks;
+	size_t count;
+	size_t next;	/* the first chunk no worker took yet */
+	pthread_mutex_t lock;
+};
+
+/* parallel_split • cuts text into at most max chunks, starting each
+ * one at a place a stream could be cut at */
+static size_t
+parallel_split(struct sd_markdown *md, const struct buf *text,
+	struct parallel_chunk *chunks, size_t max)
+{
+	struct sd_stream st;
+	struct buf view = { text->data, 0, 0, 0, BUF_GROW_UNIT, NULL };
+	size_t beg, end, last = 0, count = 0, target = text->size / max;
+	int blank = 1;
+
+	memset(&st, 0x0, sizeof(struct sd_stream));
+	st.text = &view;
+	st.html_open = bufnew_allocator(64, BUF_GROW_DOUBLE, md->allocator);
+	st.prev_blank = 1;
+
+	for (beg = 0; st.html_open && beg < text->size && count < max - 1; beg = end) {
+		for (end = beg; end < text->size && text->data[end] != '\n'; end++);
+		if (end < text->size)
+			end++;
+
+		if (blank && beg - last >= target &&
+			((text->data[beg] | 0x20) >= 'a' && (text->data[beg] | 0x20) <= 'z')) {
+			view.size = beg;
+
+			if (stream_can_cut(md, &st)) {
+				chunks[count].beg = last;
+				chunks[count].end = beg;
+				count++;
+				last = beg;
+			}
+		}
+
+		blank = is_line_blank(text->data + beg, end - beg);
+	}
+
+	chunks[count].beg = last;
+	chunks[count].end = text->size;
+	count++;
+
+	bufrelease(st.html_open);
+	return count;
+}
+
+/* parallel_uses_footnotes • whether a chunk may refer to a footnote */
+static int
+parallel_uses_footnotes(struct sd_markdown *md, const uint8_t *data, size_t size)
+{
+	const uint8_t *end = data + size;
+
+	if (!(md->parser->ext_flags & MKDEXT_FOOTNOTES) || !md->footnotes_found.count)
+		return 0;
+
+	while ((data = memchr(data, '[', end - data)) != NULL && ++data < end) {
+		if (*data == '^')
+			return 1;
+	}
+
+	return 0;
+}
+
+/* parallel_take • the next chunk for a worker, or NULL */
+static struct parallel_chunk *
+parallel_take(struct parallel_job *job)
+{
+	struct parallel_chunk *chunk = NULL;
+
+	pthread_mutex_lock(&job->lock);
+	while (job->next < job->count && job->chunks[job->next].deferred)
+		job->next++;
+	if (job->next < job->count)
+		chunk = &job->chunks[job->next++];
+	pthread_mutex_unlock(&job->lock);
+
+	return chunk;
+}
+
+/* parallel_worker • renders chunks until none are left; the memory
+ * comes from malloc, whatever the parser's allocator is */
+static void *
+parallel_worker(void *arg)
+{
+	struct parallel_job *job = arg;
+	const struct sd_allocator *allocator = &sd_allocator_default;
+	struct parallel_chunk *chunk;
+	struct sd_markdown worker;
+	struct buf *text;
+	size_t size;
+
+	memcpy(&worker, job->md, sizeof(struct sd_markdown));
+	worker.allocator = allocator;
+	worker.sink = NULL;
+	worker.sink_ob = NULL;
+	worker.borrowed = NULL;
+	worker.borrowed_size = 0;
+	worker.borrowed_work = NULL;
+	worker.tree = NULL;
+	worker.in_link_body = 0;
+
+	redcarpet_stack_init(&worker.work_bufs[BUFFER_BLOCK], 4, allocator);
+	redcarpet_stack_init(&worker.work_bufs[BUFFER_SPAN], 8, allocator);
+	redcarpet_arena_init(&worker.arena, 1024, allocator);
+
+	text = bufnew_allocator(PARALLEL_MIN_CHUNK, BUF_GROW_DOUBLE, allocator);
+
+	while (text && (chunk = parallel_take(job)) != NULL) {
+		size = chunk->end - chunk->beg;
+
+		text->size = 0;
+		bufput(text, job->text->data + chunk->beg, size);
+
+		chunk->ob = bufnew_allocator(size + (size >> 1), BUF_GROW_DOUBLE, allocator);
+		if (!chunk->ob || text->size != size) {
+			bufrelease(chunk->ob);
+			chunk->ob = NULL;
+			continue;
+		}
+
+		/* the renderer only looks at whether there is output already */
+		if (chunk->follows)
+			bufputc(chunk->ob, '\n');
+
+		parse_block(chunk->ob, &worker, text->data, text->size);
+	}
+
+	bufrelease(text);
+	release_work_bufs(&worker);
+	redcarpet_arena_free(&worker.arena);
+	return NULL;
+}
+
+/* render_blocks_parallel • render_blocks, on md->threads threads when
+ * the text is large enough */
+static void
+render_blocks_parallel(struct buf *ob, struct buf *text, struct sd_markdown *md)
+{
+	struct parallel_job job;
+	struct parallel_chunk *chunks, *chunk;
+	pthread_t *threads;
+	size_t max, i, started = 0;
+
+	max = md->threads * 4;
+	if (max > text->size / PARALLEL_MIN_CHUNK)
+		max = text->size / PARALLEL_MIN_CHUNK;
+
+	if (max < 2) {
+		render_blocks(ob, text, md);
+		return;
+	}
+
+	/* adding a final newline if not already present */
+	if (text->data[text->size - 1] != '\n' && text->data[text->size - 1] != '\r')
+		bufputc(text, '\n');
+
+	chunks = sd_malloc(md->allocator, max * sizeof(struct parallel_chunk));
+	threads = sd_malloc(md->allocator, md->threads * sizeof(pthread_t));
+
+	if (!chunks || !threads || (job.count = parallel_split(md, text, chunks, max)) < 2 ||
+		pthread_mutex_init(&job.lock, NULL) != 0) {
+		sd_free(md->allocator, chunks);
+		sd_free(md->allocator, threads);
+		parse_block(ob, md, text->data, text->size);
+		return;
+	}
+
+	job.md = md;
+	job.text = text;
+	job.chunks = chunks;
+	job.next = 0;
+
+	for (i = 0; i < job.count; ++i) {
+		chunk = &chunks[i];
+		chunk->ob = NULL;
+		chunk->follows = i > 0 || ob->size > 0;
+		chunk->deferred = parallel_uses_footnotes(md,
+			text->data + chunk->beg, chunk->end - chunk->beg);
+	}
+
+	/* this thread works along with the others */
+	for (i = 1; i < md->threads && i < job.count; ++i) {
+		if (pthread_create(&threads[started], NULL, parallel_worker, &job) == 0)
+			started++;
+	}
+
+	parallel_worker(&job);
+
+	for (i = 0; i < started; ++i)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&job.lock);
+
+	/* footnotes get their numbers here, in order; so does a chunk
+	 * which got no output buffer, or came out with nothing before it
+	 * after all */
+	for (i = 0; i < job.count; ++i) {
+		chunk = &chunks[i];
+
+		if (chunk->ob && chunk->follows == (ob->size > 0))
+			bufput(ob, chunk->ob->data + chunk->follows, chunk->ob->size - chunk->follows);
+		else
+			parse_block(ob, md, text->data + chunk->beg, chunk->end - chunk->beg);
+
+		bufrelease(chunk->ob);
+	}
+
+	sd_free(md->allocator, chunks);
+	sd_free(md->allocator, threads);
+}
+
+/* A batch of documents is shared out between threads the same way,
+ * each of them rendering whole documents with a parser of its own */
+
+struct batch_job {
+	struct buf **obs;
+	const uint8_t **documents;
+	const size_t *sizes;
+	size_t count;
+	size_t next;	/* the first document no worker took yet */
+	pthread_mutex_t lock;
+};
+
+struct batch_worker {
+	struct batch_job *job;
+	struct sd_markdown *md;
+};
+
+/* batch_render • renders documents until none are left */
+static void *
+batch_render(void *arg)
+{
+	struct batch_worker *worker = arg;
+	struct batch_job *job = worker->job;
+	size_t i, size;
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (i >= job->count)
+			break;
+
+		size = job->sizes[i];
+		job->obs[i] = bufnew_allocator(64 + size + (size >> 1), BUF_GROW_DOUBLE, worker->md->allocator);
+		if (job->obs[i])
+			sd_markdown_render(job->obs[i], job->documents[i], size, worker->md);
+	}
+
+	return NULL;
+}
+
+/* batch_render_parallel • renders a batch on one thread per parser,
+ * leaving it all to the caller when threads can't be had */
+static void
+batch_render_parallel(struct buf **obs, const uint8_t **documents, const size_t *sizes,
+	size_t count, struct sd_markdown **parsers, unsigned int nparsers)
+{
+	const struct sd_allocator *allocator = parsers[0]->allocator;
+	struct batch_job job;
+	struct batch_worker *workers;
+	pthread_t *threads;
+	size_t i, started = 0;
+
+	if (nparsers > count)
+		nparsers = (unsigned int)count;
+
+	workers = sd_malloc(allocator, nparsers * sizeof(struct batch_worker));
+	threads = sd_malloc(allocator, nparsers * sizeof(pthread_t));
+
+	if (!workers || !threads || pthread_mutex_init(&job.lock, NULL) != 0) {
+		sd_free(allocator, workers);
+		sd_free(allocator, threads);
+		return;
+	}
+
+	job.obs = obs;
+	job.documents = documents;
+	job.sizes = sizes;
+	job.count = count;
+	job.next = 0;
+
+	/* this thread works along with the others */
+	for (i = 0; i < nparsers; ++i) {
+		workers[i].job = &job;
+		workers[i].md = parsers[i];
+
+		if (i > 0 && pthread_create(&threads[started], NULL, batch_render, &workers[i]) == 0)
+			started++;
+	}
+
+	batch_render(&workers[0]);
+
+	for (i = 0; i < started; ++i)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&job.lock);
+	sd_free(allocator, workers);
+	sd_free(allocator, threads);
+}
+
+#else
+
+static void
+render_blocks_parallel(struct buf *ob, struct buf *text, struct sd_markdown *md)
+{
+	render_blocks(ob, text, md);
+}
+
+static void
+batch_render_parallel(struct buf **obs, const uint8_t **documents, const size_t *sizes,
+	size_t count, struct sd_markdown **parsers, unsigned int nparsers)
+{
+}
+
+#endif
+
+void
+sd_markdown_budget(struct sd_markdown *md, size_t work)
+{
+	md->budget = work;
+}
+
+int
+sd_markdown_truncated(const struct sd_markdown *md)
+{
+	return md->truncated;
+}
+
+int
+sd_markdown_parallel(struct sd_markdown *md, unsigned int threads)
+{
+#ifdef HAVE_PTHREAD_H
+	md->threads = threads ? threads : 1;
+	return 1;
+#else
+	md->threads = 1;
+	return threads <= 1;
+#endif
+}
+
+int
+sd_markdown_render_many(struct buf **obs, const uint8_t **documents, const size_t *sizes,
+	size_t count, struct sd_markdown **parsers, unsigned int nparsers)
+{
+	size_t i;
+	int err = BUF_OK;
+
+	memset(obs, 0x0, count * sizeof(struct buf *));
+
+	if (nparsers > 1 && count > 1)
+		batch_render_parallel(obs, documents, sizes, count, parsers, nparsers);
+
+	/* whatever is left, on this thread */
+	for (i = 0; i < count; ++i) {
+		if (!obs[i]) {
+			obs[i] = bufnew_allocator(64 + sizes[i], BUF_GROW_DOUBLE, parsers[0]->allocator);
+			if (obs[i])
+				sd_markdown_render(obs[i], documents[i], sizes[i], parsers[0]);
+			else
+				err = BUF_ENOMEM;
+		}
+	}
+
+	return err;
+}
+
+void *
+sd_markdown_set_opaque(struct sd_markdown *md, void *opaque)
+{
+	void *previous = md->opaque;
+
+	md->opaque = opaque;
+	return previous;
+}
+
+void
+sd_markdown_reset(struct sd_markdown *md)
+{
+	stream_reset(md);
+
+	md->work_bufs[BUFFER_SPAN].size = 0;
+	md->work_bufs[BUFFER_BLOCK].size = 0;
+	md->in_link_body = 0;
+
+	/* the blocks of an unfinished render can't be spliced into */
+	if (md->index)
+		md->index->valid = 0;
+
+	/* nor can an unfinished tree be used */
+	if (md->tree) {
+		md->parser = md->tree_parser;
+		sd_tree_free(md->tree);
+		md->tree = NULL;
+	}
+
+	redcarpet_arena_reset(&md->arena);
+}
+
+void
+sd_markdown_free(struct sd_markdown *md)
+{
+	release_work_bufs(md);
+	redcarpet_arena_free(&md->arena);
+
+	bufrelease(md->stream.pending);
+	bufrelease(md->stream.text);
+	bufrelease(md->stream.ob);
+	bufrelease(md->stream.html_open);
+	bufrelease(md->borrowed_work);
+	redcarpet_cache_free(md->cache);
+	index_free(md->allocator, md->index);
+
+	if (md->owns_parser)
+		sd_free(md->allocator, (void *)md->parser);
 
-	free(md);
+	sd_free(md->allocator, md);
 }
@@ -25,6 +25,7 @@
 #define MARKDOWN_H__
 
 #include "buffer.h"
+#include "rope.h"
 #include "autolink.h"
 
 #ifdef __cplusplus
@@ -110,6 +111,8 @@ struct sd_callbacks {
 };
 
 struct sd_markdown;
+struct sd_tree;
+struct render_cache;
 
 /*********
  * FLAGS *
@@ -123,16 +126,100 @@ struct sd_markdown;
  * EXPORTED FUNCTIONS *
  **********************/
 
+/* sd_markdown_new • allocates a parser; a NULL allocator uses sd_allocator_default */
 extern struct sd_markdown *
 sd_markdown_new(
 	unsigned int extensions,
 	size_t max_nesting,
 	const struct sd_callbacks *callbacks,
-	void *opaque);
+	void *opaque,
+	const struct sd_allocator *allocator);
+
+/* sd_markdown_fork • allocates a parser sharing the configuration of md,
+ * which it must not outlive, with a state and an opaque pointer of its
+ * own. The configuration is never written to, so forks of one parser
+ * can render on several threads at once, as long as their opaque
+ * pointers (which the HTML renderer keeps its table of contents
+ * state in) are not shared either */
+extern struct sd_markdown *
+sd_markdown_fork(const struct sd_markdown *md, void *opaque, const struct sd_allocator *allocator);
 
 extern void
 sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md);
 
+/* sd_markdown_render_rope • renders into a rope, handing over output
+ * between top-level blocks instead of keeping it contiguous */
+extern int
+sd_markdown_render_rope(struct rope *rope, const uint8_t *document, size_t doc_size, struct sd_markdown *md);
+
+/* sd_markdown_render_incremental • renders a new version of the document
+ * given to the previous call, parsing again only the blocks around what
+ * changed; returns 1 when it could, 0 after a full render */
+extern int
+sd_markdown_render_incremental(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md);
+
+/* sd_markdown_render_many • renders count documents into new buffers,
+ * on one thread per parser, each rendering whole documents with its
+ * own; the buffers of those which couldn't be allocated are NULL */
+extern int
+sd_markdown_render_many(struct buf **obs, const uint8_t **documents, const size_t *sizes,
+	size_t count, struct sd_markdown **parsers, unsigned int nparsers);
+
+/* sd_markdown_set_opaque • hands the callbacks another opaque pointer,
+ * returning the one they had */
+extern void *
+sd_markdown_set_opaque(struct sd_markdown *md, void *opaque);
+
+/* sd_markdown_parallel • makes sd_markdown_render cut large documents
+ * into chunks rendered on up to that many threads, calling the callbacks
+ * from all of them; returns 0 when built without thread support */
+extern int
+sd_markdown_parallel(struct sd_markdown *md, unsigned int threads);
+
+/* sd_markdown_budget • bounds the work of every render: each byte going
+ * through the inline parser, each active character in it and each block
+ * costs one unit. Once they are spent, the rest of the document comes
+ * out as paragraphs of plain text; 0, the default, means no bound */
+extern void
+sd_markdown_budget(struct sd_markdown *md, size_t work);
+
+/* sd_markdown_truncated • whether the last render ran out of budget */
+extern int
+sd_markdown_truncated(const struct sd_markdown *md);
+
+/* sd_markdown_cache • makes sd_markdown_render keep up to budget bytes of
+ * documents and their output, and hand the output back when given the
+ * same text again; seed stands for whatever else the output depends on
+ * (render flags...). A budget of 0 drops the cache; returns 0 when out
+ * of memory */
+extern int
+sd_markdown_cache(struct sd_markdown *md, size_t budget, uint64_t seed);
+
+/* sd_markdown_get_cache • the cache set up by sd_markdown_cache, if any,
+ * with its hit, miss and eviction counters (see cache.h) */
+extern const struct render_cache *
+sd_markdown_get_cache(const struct sd_markdown *md);
+
+/* sd_markdown_parse • parses a document into a tree of nodes (see tree.h)
+ * rather than rendering it, for sd_tree_render to replay into any number
+ * of renderers; returns NULL when out of memory */
+extern struct sd_tree *
+sd_markdown_parse(const uint8_t *document, size_t doc_size, struct sd_markdown *md);
+
+/* sd_markdown_feed • renders a document given in pieces, appending to ob
+ * whatever is done; references must be defined before they are used */
+extern int
+sd_markdown_feed(struct buf *ob, const uint8_t *data, size_t size, struct sd_markdown *md);
+
+/* sd_markdown_finish • renders the rest of a fed document */
+extern int
+sd_markdown_finish(struct buf *ob, struct sd_markdown *md);
+
+/* sd_markdown_reset • drops a fed document that won't be finished, or
+ * the state of a render that was cut short */
+extern void
+sd_markdown_reset(struct sd_markdown *md);
+
 extern void
 sd_markdown_free(struct sd_markdown *md);
 
@@ -21,13 +21,47 @@
  */
 
 #include "redcarpet.h"
+#include "tree.h"
+#include "cache.h"
+
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+
+/* Below this size, handing the GVL over costs more than the render */
+#define NOGVL_MIN_SIZE 2048
 
 VALUE rb_mRedcarpet;
 VALUE rb_cMarkdown;
+VALUE rb_cDocument;
 VALUE rb_cRenderHTML_TOC;
 
 extern VALUE rb_cRenderBase;
 
+/* Route the parser's memory through Ruby's allocator so that
+ * the GC accounts for it */
+static void *rb_redcarpet_malloc(size_t size, void *opaque)
+{
+	return ruby_xmalloc(size);
+}
+
+static void *rb_redcarpet_realloc(void *ptr, size_t size, void *opaque)
+{
+	return ruby_xrealloc(ptr, size);
+}
+
+static void rb_redcarpet_free(void *ptr, void *opaque)
+{
+	ruby_xfree(ptr);
+}
+
+const struct sd_allocator rb_redcarpet_allocator = {
+	rb_redcarpet_malloc,
+	rb_redcarpet_realloc,
+	rb_redcarpet_free,
+	NULL
+};
+
 static void rb_redcarpet_md_flags(VALUE hash, unsigned int *enabled_extensions_p)
 {
 	unsigned int extensions = 0;
@@ -79,10 +113,52 @@ static void rb_redcarpet_md_flags(VALUE hash, unsigned int *enabled_extensions_p
 	*enabled_extensions_p = extensions;
 }
 
+/* The parsers render_many shares a batch out to, one per thread */
+struct rb_redcarpet_pool {
+	struct sd_markdown **parsers;
+	struct redcarpet_renderopt *options;	/* each parser's own copy */
+	unsigned int size;
+};
+
+/* A Markdown object. Its parser is busy for as long as a render uses
+ * it: other threads, which may run when the render releases the GVL or
+ * calls back into Ruby, then get a parser of their own, see
+ * rb_redcarpet_md__parser. The same goes for the pool of render_many */
+struct rb_redcarpet_md {
+	struct sd_markdown *markdown;
+	struct rb_redcarpet_pool *pool;
+	unsigned int threads;	/* to render one document on */
+	unsigned int pool_size;	/* to render a batch on */
+	int native;	/* no Ruby callbacks: renders without the GVL */
+	int busy;
+	void *opaque;	/* the parser's own, while a render has it */
+	int pool_busy;
+	int truncated;	/* the last render ran out of budget */
+};
+
+static void
+rb_redcarpet_pool__free(struct rb_redcarpet_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->size; ++i)
+		sd_markdown_free(pool->parsers[i]);
+
+	xfree(pool->parsers);
+	xfree(pool->options);
+	xfree(pool);
+}
+
 static void
-rb_redcarpet_md__free(void *markdown)
+rb_redcarpet_md__free(void *ptr)
 {
-	sd_markdown_free((struct sd_markdown *)markdown);
+	struct rb_redcarpet_md *md = ptr;
+	rb_redcarpet_pool__free(md->pool);
+	sd_markdown_free(md->markdown);
+	xfree(md);
 }
 
 static const rb_data_type_t rb_redcarpet_md__type = {
@@ -98,11 +174,15 @@ static const rb_data_type_t rb_redcarpet_md__type = {
 
 static VALUE rb_redcarpet_md__new(int argc, VALUE *argv, VALUE klass)
 {
-	VALUE rb_markdown, rb_rndr, hash, rndr_options;
-	unsigned int extensions = 0;
+	VALUE rb_markdown, rb_rndr, hash, rndr_options, cache_size = Qnil, threads = Qnil;
+	VALUE max_nesting = Qnil, work_budget = Qnil;
+	unsigned int extensions = 0, nthreads = 1, pool_size = 1;
+	size_t nesting = 16;
+	int native;
 
 	struct rb_redcarpet_rndr *rndr;
 	struct sd_markdown *markdown;
+	struct rb_redcarpet_md *md;
 
 	if (rb_scan_args(argc, argv, "11", &rb_rndr, &hash) == 2)
 		rb_redcarpet_md_flags(hash, &extensions);
@@ -130,47 +210,842 @@ static VALUE rb_redcarpet_md__new(int argc, VALUE *argv, VALUE klass)
 		rb_iv_set(rb_rndr, "@options", rndr_options);
 	}
 
-	markdown = sd_markdown_new(extensions, 16, &rndr->callbacks, &rndr->options);
+	if (hash != Qnil) {
+		max_nesting = rb_hash_lookup(hash, CSTR2SYM("max_nesting"));
+		work_budget = rb_hash_lookup(hash, CSTR2SYM("work_budget"));
+	}
+
+	if (!NIL_P(max_nesting) && (nesting = NUM2SIZET(max_nesting)) == 0)
+		rb_raise(rb_eArgError, "max_nesting must be positive");
+
+	/* a parser which may run without the GVL can't use Ruby's allocator */
+	native = rb_redcarpet_rndr_native(rb_rndr);
+	markdown = sd_markdown_new(extensions, nesting, &rndr->callbacks, &rndr->options,
+		native ? &sd_allocator_default : &rb_redcarpet_allocator);
 	if (!markdown)
 		rb_raise(rb_eRuntimeError, "Failed to create new Renderer class");
 
-	rb_markdown = TypedData_Wrap_Struct(klass, &rb_redcarpet_md__type, markdown);
+	/* the output of a native renderer only depends on the text, the
+	 * extensions and its flags */
+	if (hash != Qnil) {
+		cache_size = rb_hash_lookup(hash, CSTR2SYM("cache_size"));
+		threads = rb_hash_lookup(hash, CSTR2SYM("threads"));
+	}
+
+	/* the other threads can't call into Ruby, and the table of contents
+	 * is numbered over the whole document */
+	if (!NIL_P(threads) && native) {
+		pool_size = NUM2UINT(threads) ? NUM2UINT(threads) : 1;
+		if (!rb_obj_is_kind_of(rb_rndr, rb_cRenderHTML_TOC))
+			nthreads = pool_size;
+	}
+
+	if (!NIL_P(cache_size) && !sd_markdown_cache(markdown, NUM2SIZET(cache_size), rndr->options.html.flags)) {
+		sd_markdown_free(markdown);
+		rb_raise(rb_eNoMemError, "failed to allocate render cache");
+	}
+
+	sd_markdown_parallel(markdown, nthreads);
+
+	if (!NIL_P(work_budget))
+		sd_markdown_budget(markdown, NUM2SIZET(work_budget));
+
+	rb_markdown = TypedData_Make_Struct(klass, struct rb_redcarpet_md, &rb_redcarpet_md__type, md);
+	md->markdown = markdown;
+	md->pool = NULL;
+	md->threads = nthreads;
+	md->pool_size = pool_size;
+	md->native = native;
+	md->busy = 0;
+	md->opaque = NULL;
+	md->pool_busy = 0;
+	md->truncated = 0;
 	rb_iv_set(rb_markdown, "@renderer", rb_rndr);
 
 	return rb_markdown;
 }
 
-static VALUE rb_redcarpet_md_render(VALUE self, VALUE text)
+/* The parser to render with: the object's own, which is then busy,
+ * unless another render has it, in which case a fork of it. Either one
+ * renders with a copy of the renderer's options, kept in `options`,
+ * since the table of contents keeps its state there;
+ * rb_redcarpet_md__done gives the parser back */
+static struct sd_markdown *
+rb_redcarpet_md__parser(struct rb_redcarpet_md *md, struct rb_redcarpet_rndr *renderer,
+	struct redcarpet_renderopt *options)
 {
-	VALUE rb_rndr;
-	struct buf *output_buf;
 	struct sd_markdown *markdown;
 
+	*options = renderer->options;
+
+	if (!md->busy) {
+		md->opaque = sd_markdown_set_opaque(md->markdown, options);
+		md->busy = 1;
+		return md->markdown;
+	}
+
+	markdown = sd_markdown_fork(md->markdown, options, &sd_allocator_default);
+	if (!markdown)
+		rb_raise(rb_eNoMemError, "failed to allocate parser");
+
+	return markdown;
+}
+
+static void
+rb_redcarpet_md__done(struct rb_redcarpet_md *md, struct sd_markdown *markdown)
+{
+	md->truncated = sd_markdown_truncated(markdown);
+
+	if (markdown == md->markdown) {
+		sd_markdown_set_opaque(markdown, md->opaque);
+		md->busy = 0;
+	} else {
+		sd_markdown_free(markdown);
+	}
+}
+
+/* A render holding the GVL. Ruby callbacks may raise out of it, so it
+ * runs under rb_ensure, which gives the parser back either way */
+struct rb_redcarpet_job {
+	struct rb_redcarpet_md *md;
+	struct sd_markdown *markdown;
+	struct redcarpet_renderopt options;
+	const uint8_t *text;
+	size_t size;
+	int incremental;
+	struct buf *ob;		/* the output of render... */
+	struct rope *rope;	/* ...or of render_chunks... */
+	struct sd_tree *tree;	/* ...or the tree of parse */
+	int err;
+	int done;
+};
+
+static VALUE rb_redcarpet_md__job(VALUE arg)
+{
+	struct rb_redcarpet_job *job = (struct rb_redcarpet_job *)arg;
+
+	if (job->rope)
+		job->err = sd_markdown_render_rope(job->rope, job->text, job->size, job->markdown);
+	else if (!job->ob)
+		job->tree = sd_markdown_parse(job->text, job->size, job->markdown);
+	else if (job->incremental)
+		sd_markdown_render_incremental(job->ob, job->text, job->size, job->markdown);
+	else
+		sd_markdown_render(job->ob, job->text, job->size, job->markdown);
+
+	job->done = 1;
+	return Qnil;
+}
+
+static VALUE rb_redcarpet_md__job_ensure(VALUE arg)
+{
+	struct rb_redcarpet_job *job = (struct rb_redcarpet_job *)arg;
+
+	/* a callback raised half way through the document */
+	if (!job->done) {
+		sd_markdown_reset(job->markdown);
+		bufrelease(job->ob);
+		if (job->rope)
+			redcarpet_rope_free(job->rope);
+	}
+
+	rb_redcarpet_md__done(job->md, job->markdown);
+	return Qnil;
+}
+
+/* Run a job on the object's parser, or on a fork of it; the output is
+ * left in the job */
+static void
+rb_redcarpet_md__run(struct rb_redcarpet_job *job, struct rb_redcarpet_md *md,
+	struct rb_redcarpet_rndr *renderer, VALUE text)
+{
+	job->md = md;
+	job->text = (const uint8_t *)RSTRING_PTR(text);
+	job->size = RSTRING_LEN(text);
+	job->tree = NULL;
+	job->err = 0;
+	job->done = 0;
+	job->markdown = rb_redcarpet_md__parser(md, renderer, &job->options);
+
+	rb_ensure(rb_redcarpet_md__job, (VALUE)job, rb_redcarpet_md__job_ensure, (VALUE)job);
+}
+
+#ifdef HAVE_RUBY_THREAD_H
+struct rb_redcarpet_nogvl {
+	struct sd_markdown *markdown;
+	struct buf *ob;
+	uint8_t *text;
+	size_t size;
+	int done;
+};
+
+static void *rb_redcarpet_md__render_nogvl(void *arg)
+{
+	struct rb_redcarpet_nogvl *job = arg;
+
+	sd_markdown_render(job->ob, job->text, job->size, job->markdown);
+	job->done = 1;
+	return NULL;
+}
+
+/* Render with a native renderer, letting other threads run meanwhile.
+ * The render gets a private copy of the text, which Ruby may move or
+ * free while the GVL is released, and of the renderer's options, which
+ * the table of contents keeps its state in */
+static VALUE rb_redcarpet_md__render_without_gvl(struct rb_redcarpet_md *md, VALUE text,
+	struct rb_redcarpet_rndr *renderer)
+{
+	struct rb_redcarpet_nogvl job;
+	struct redcarpet_renderopt options;
+	VALUE output;
+
+	job.markdown = rb_redcarpet_md__parser(md, renderer, &options);
+
+	job.size = RSTRING_LEN(text);
+	job.text = malloc(job.size);
+	job.ob = bufnew_allocator(128, BUF_GROW_DOUBLE, &sd_allocator_default);
+	if (!job.text || !job.ob) {
+		free(job.text);
+		bufrelease(job.ob);
+		rb_redcarpet_md__done(md, job.markdown);
+		rb_raise(rb_eNoMemError, "failed to allocate render output");
+	}
+
+	memcpy(job.text, RSTRING_PTR(text), job.size);
+
+	/* this one doesn't raise on interrupts, which would leave the parser
+	 * busy; it doesn't even start the render when one is pending */
+	job.done = 0;
+	rb_thread_call_without_gvl2(rb_redcarpet_md__render_nogvl, &job, NULL, NULL);
+	if (!job.done)
+		rb_redcarpet_md__render_nogvl(&job);
+
+	rb_redcarpet_md__done(md, job.markdown);
+
+	output = rb_enc_str_new((const char*)job.ob->data, job.ob->size, rb_enc_get(text));
+
+	free(job.text);
+	bufrelease(job.ob);
+	return output;
+}
+#endif
+
+static VALUE rb_redcarpet_md__render(VALUE self, VALUE text, int incremental)
+{
+	VALUE rb_rndr;
+	struct rb_redcarpet_job job;
+	struct rb_redcarpet_md *md;
+
 	Check_Type(text, T_STRING);
 
 	rb_rndr = rb_iv_get(self, "@renderer");
-	TypedData_Get_Struct(self, struct sd_markdown, &rb_redcarpet_md__type, markdown);
+	TypedData_Get_Struct(self, struct rb_redcarpet_md, &rb_redcarpet_md__type, md);
 
 	if (rb_respond_to(rb_rndr, rb_intern("preprocess")))
 		text = rb_funcall(rb_rndr, rb_intern("preprocess"), 1, text);
 	if (NIL_P(text))
 		return Qnil;
 
+	/* the document may be parsed in place: hold on to a frozen copy
+	 * (sharing its bytes) in case a callback modifies the original */
+	text = rb_str_new_frozen(text);
+
 	struct rb_redcarpet_rndr *renderer = rb_redcarpet_rndr_unwrap(rb_rndr);
 	renderer->options.active_enc = rb_enc_get(text);
 
+#ifdef HAVE_RUBY_THREAD_H
+	if (md->native && !incremental && RSTRING_LEN(text) >= NOGVL_MIN_SIZE) {
+		text = rb_redcarpet_md__render_without_gvl(md, text, renderer);
+
+		if (rb_respond_to(rb_rndr, rb_intern("postprocess")))
+			text = rb_funcall(rb_rndr, rb_intern("postprocess"), 1, text);
+
+		return text;
+	}
+#endif
+
 	/* initialize buffers */
-	output_buf = bufnew(128);
+	job.ob = bufnew_allocator(128, BUF_GROW_DOUBLE, &rb_redcarpet_allocator);
+	job.rope = NULL;
+	job.incremental = incremental;
 
 	/* render the magic */
-	sd_markdown_render(
-		output_buf,
-		(const uint8_t*)RSTRING_PTR(text),
-		RSTRING_LEN(text),
-		markdown);
+	rb_redcarpet_md__run(&job, md, renderer, text);
 
 	/* build the Ruby string */
-	text = rb_enc_str_new((const char*)output_buf->data, output_buf->size, rb_enc_get(text));
+	text = rb_enc_str_new((const char*)job.ob->data, job.ob->size, rb_enc_get(text));
+
+	bufrelease(job.ob);
+
+	if (rb_respond_to(rb_rndr, rb_intern("postprocess")))
+		text = rb_funcall(rb_rndr, rb_intern("postprocess"), 1, text);
+
+	return text;
+}
+
+static VALUE rb_redcarpet_md_render(VALUE self, VALUE text)
+{
+	return rb_redcarpet_md__render(self, text, 0);
+}
+
+static VALUE rb_redcarpet_md_render_incremental(VALUE self, VALUE text)
+{
+	VALUE rb_rndr = rb_iv_get(self, "@renderer");
+
+	/* the table of contents is numbered over the whole document */
+	if (rb_obj_is_kind_of(rb_rndr, rb_cRenderHTML_TOC))
+		return rb_redcarpet_md__render(self, text, 0);
+
+	return rb_redcarpet_md__render(self, text, 1);
+}
+
+#ifdef HAVE_RUBY_THREAD_H
+static struct rb_redcarpet_pool *
+rb_redcarpet_pool__new(struct rb_redcarpet_md *md, struct rb_redcarpet_rndr *renderer)
+{
+	struct rb_redcarpet_pool *pool = ZALLOC(struct rb_redcarpet_pool);
+	unsigned int i;
+
+	pool->parsers = ZALLOC_N(struct sd_markdown *, md->pool_size);
+	pool->options = ALLOC_N(struct redcarpet_renderopt, md->pool_size);
+
+	for (pool->size = 0; pool->size < md->pool_size; pool->size++) {
+		i = pool->size;
+		pool->options[i] = renderer->options;
+		pool->parsers[i] = sd_markdown_fork(md->markdown, &pool->options[i], &sd_allocator_default);
+
+		if (!pool->parsers[i]) {
+			rb_redcarpet_pool__free(pool);
+			rb_raise(rb_eNoMemError, "failed to allocate parser");
+		}
+
+		/* the batch is already spread over the pool's threads */
+		sd_markdown_parallel(pool->parsers[i], 1);
+	}
+
+	return pool;
+}
+
+struct rb_redcarpet_batch {
+	struct rb_redcarpet_md *md;
+	struct rb_redcarpet_pool *pool;
+	struct buf **obs;
+	const uint8_t **documents;
+	size_t *sizes;
+	size_t count;
+	uint8_t *copy;
+	VALUE sources;
+	int done;
+	int oom;
+};
+
+static void *rb_redcarpet_md__render_many_nogvl(void *arg)
+{
+	struct rb_redcarpet_batch *batch = arg;
+
+	sd_markdown_render_many(batch->obs, batch->documents, batch->sizes, batch->count,
+		batch->pool->parsers, batch->pool->size);
+	batch->done = 1;
+	return NULL;
+}
+
+/* Turn the outputs of a rendered batch into Strings, releasing each
+ * output as it goes */
+static VALUE rb_redcarpet_md__render_many_results(VALUE arg)
+{
+	struct rb_redcarpet_batch *batch = (struct rb_redcarpet_batch *)arg;
+	VALUE results, source;
+	size_t i, j;
+
+	results = rb_ary_new_capa(RARRAY_LEN(batch->sources));
+	for (i = 0, j = 0; i < (size_t)RARRAY_LEN(batch->sources); ++i) {
+		source = RARRAY_AREF(batch->sources, i);
+
+		if (NIL_P(source) || !batch->done) {
+			rb_ary_push(results, Qnil);
+			continue;
+		}
+
+		if (batch->obs[j]) {
+			rb_ary_push(results, rb_enc_str_new((const char *)batch->obs[j]->data,
+				batch->obs[j]->size, rb_enc_get(source)));
+			bufrelease(batch->obs[j]);
+			batch->obs[j] = NULL;
+		} else {
+			rb_ary_push(results, Qnil);
+			batch->oom = 1;
+		}
+		j++;
+	}
+
+	return results;
+}
+
+/* Free what a batch holds and give the pool back, even when building
+ * the results raised */
+static VALUE rb_redcarpet_md__render_many_ensure(VALUE arg)
+{
+	struct rb_redcarpet_batch *batch = (struct rb_redcarpet_batch *)arg;
+	size_t j;
+
+	if (batch->done) {
+		for (j = 0; j < batch->count; ++j)
+			bufrelease(batch->obs[j]);
+	}
+
+	free(batch->obs);
+	free(batch->documents);
+	free(batch->sizes);
+	free(batch->copy);
+
+	if (batch->pool == batch->md->pool)
+		batch->md->pool_busy = 0;
+	else
+		rb_redcarpet_pool__free(batch->pool);
+
+	return Qnil;
+}
+
+/* Render a batch of documents with a native renderer, on the parsers
+ * of the pool and without the GVL. Like render, the batch works on a
+ * copy of the texts */
+static VALUE rb_redcarpet_md__render_many(struct rb_redcarpet_md *md, VALUE rb_rndr, VALUE sources)
+{
+	struct rb_redcarpet_batch batch;
+	struct rb_redcarpet_rndr *renderer = rb_redcarpet_rndr_unwrap(rb_rndr);
+	VALUE results, source;
+	size_t i, j, total = 0;
+
+	batch.md = md;
+	batch.sources = sources;
+	batch.count = 0;
+	batch.done = 0;
+	for (i = 0; i < (size_t)RARRAY_LEN(sources); ++i) {
+		source = RARRAY_AREF(sources, i);
+		if (!NIL_P(source)) {
+			batch.count++;
+			total += RSTRING_LEN(source);
+		}
+	}
+
+	if (md->pool_busy) {
+		batch.pool = rb_redcarpet_pool__new(md, renderer);
+	} else {
+		if (!md->pool)
+			md->pool = rb_redcarpet_pool__new(md, renderer);
+		batch.pool = md->pool;
+		md->pool_busy = 1;
+	}
+
+	batch.obs = malloc(batch.count * sizeof(struct buf *) + 1);
+	batch.documents = malloc(batch.count * sizeof(uint8_t *) + 1);
+	batch.sizes = malloc(batch.count * sizeof(size_t) + 1);
+	batch.copy = malloc(total + 1);
+
+	if ((batch.oom = !batch.obs || !batch.documents || !batch.sizes || !batch.copy) == 0) {
+		for (i = 0, j = 0, total = 0; i < (size_t)RARRAY_LEN(sources); ++i) {
+			source = RARRAY_AREF(sources, i);
+			if (NIL_P(source))
+				continue;
+
+			batch.sizes[j] = RSTRING_LEN(source);
+			batch.documents[j] = batch.copy + total;
+			memcpy(batch.copy + total, RSTRING_PTR(source), batch.sizes[j]);
+			total += batch.sizes[j++];
+		}
+
+		rb_thread_call_without_gvl2(rb_redcarpet_md__render_many_nogvl, &batch, NULL, NULL);
+		if (!batch.done)
+			rb_redcarpet_md__render_many_nogvl(&batch);
+	}
+
+	results = rb_ensure(rb_redcarpet_md__render_many_results, (VALUE)&batch,
+		rb_redcarpet_md__render_many_ensure, (VALUE)&batch);
+
+	if (batch.oom)
+		rb_raise(rb_eNoMemError, "failed to allocate render output");
+
+	return results;
+}
+#endif
+
+static VALUE rb_redcarpet_md_render_many(VALUE self, VALUE texts)
+{
+	VALUE rb_rndr, sources, results, text;
+	struct rb_redcarpet_md *md;
+	long i;
+
+	Check_Type(texts, T_ARRAY);
+
+	rb_rndr = rb_iv_get(self, "@renderer");
+	TypedData_Get_Struct(self, struct rb_redcarpet_md, &rb_redcarpet_md__type, md);
+
+#ifdef HAVE_RUBY_THREAD_H
+	if (md->native) {
+		sources = rb_ary_new_capa(RARRAY_LEN(texts));
+
+		for (i = 0; i < RARRAY_LEN(texts); ++i) {
+			text = RARRAY_AREF(texts, i);
+			Check_Type(text, T_STRING);
+
+			if (rb_respond_to(rb_rndr, rb_intern("preprocess")))
+				text = rb_funcall(rb_rndr, rb_intern("preprocess"), 1, text);
+			if (!NIL_P(text))
+				Check_Type(text, T_STRING);
+
+			rb_ary_push(sources, text);
+		}
+
+		results = rb_redcarpet_md__render_many(md, rb_rndr, sources);
+
+		if (rb_respond_to(rb_rndr, rb_intern("postprocess"))) {
+			for (i = 0; i < RARRAY_LEN(results); ++i) {
+				text = RARRAY_AREF(results, i);
+				if (!NIL_P(text))
+					rb_ary_store(results, i, rb_funcall(rb_rndr, rb_intern("postprocess"), 1, text));
+			}
+		}
+
+		return results;
+	}
+#endif
+
+	results = rb_ary_new_capa(RARRAY_LEN(texts));
+	for (i = 0; i < RARRAY_LEN(texts); ++i)
+		rb_ary_push(results, rb_redcarpet_md__render(self, RARRAY_AREF(texts, i), 0));
+
+	return results;
+}
+
+struct rb_redcarpet_chunks {
+	struct rope *rope;
+	rb_encoding *enc;
+	VALUE chunks;	/* Qnil when they are yielded */
+};
+
+/* Build one String per rope chunk, releasing each chunk as soon as it
+ * has been copied, and yield it or collect it. A multibyte character
+ * straddling two chunks is carried over to the next one so that every
+ * String is valid in its own right */
+static VALUE rb_redcarpet_rope__each(VALUE arg)
+{
+	struct rb_redcarpet_chunks *out = (struct rb_redcarpet_chunks *)arg;
+	struct rope *rope = out->rope;
+	rb_encoding *enc = out->enc;
+	const struct rope_chunk *chunk;
+	const char *data, *end, *head;
+	char carry[8];
+	size_t carry_len = 0, len;
+	VALUE str;
+
+	while ((chunk = rope->head) != NULL) {
+		data = (const char *)chunk->data;
+		end = data + chunk->size;
+		len = chunk->size;
+
+		if (chunk->next && len > 0) {
+			head = rb_enc_left_char_head(data, end - 1, end, enc);
+			if (MBCLEN_NEEDMORE_P(rb_enc_precise_mbclen(head, end, enc)) &&
+				(size_t)(end - head) < sizeof(carry) - carry_len)
+				len = head - data;
+		}
+
+		str = rb_enc_str_new(carry, carry_len, enc);
+		rb_str_cat(str, data, len);
+
+		carry_len = chunk->size - len;
+		memcpy(carry, data + len, carry_len);
+		redcarpet_rope_shift(rope);
+
+		if (NIL_P(out->chunks))
+			rb_yield(str);
+		else
+			rb_ary_push(out->chunks, str);
+	}
+
+	return out->chunks;
+}
+
+static VALUE rb_redcarpet_rope__free(VALUE arg)
+{
+	struct rb_redcarpet_chunks *out = (struct rb_redcarpet_chunks *)arg;
+
+	redcarpet_rope_free(out->rope);
+	return Qnil;
+}
+
+/* The output as an Array of Strings, or with a block, yielded one
+ * String at a time */
+static VALUE rb_redcarpet_md_render_chunks(VALUE self, VALUE text)
+{
+	VALUE rb_rndr;
+	struct rb_redcarpet_job job;
+	struct rb_redcarpet_chunks out;
+	struct rope rope;
+	struct rb_redcarpet_md *md;
+
+	Check_Type(text, T_STRING);
+
+	rb_rndr = rb_iv_get(self, "@renderer");
+	out.chunks = rb_block_given_p() ? Qnil : rb_ary_new();
+
+	/* postprocess needs the whole document at once */
+	if (rb_respond_to(rb_rndr, rb_intern("postprocess"))) {
+		text = rb_redcarpet_md_render(self, text);
+		if (!NIL_P(text)) {
+			if (NIL_P(out.chunks))
+				rb_yield(text);
+			else
+				rb_ary_push(out.chunks, text);
+		}
+		return NIL_P(out.chunks) ? self : out.chunks;
+	}
+
+	TypedData_Get_Struct(self, struct rb_redcarpet_md, &rb_redcarpet_md__type, md);
+
+	if (rb_respond_to(rb_rndr, rb_intern("preprocess")))
+		text = rb_funcall(rb_rndr, rb_intern("preprocess"), 1, text);
+	if (NIL_P(text))
+		return NIL_P(out.chunks) ? self : out.chunks;
+
+	text = rb_str_new_frozen(text);
+
+	struct rb_redcarpet_rndr *renderer = rb_redcarpet_rndr_unwrap(rb_rndr);
+	renderer->options.active_enc = rb_enc_get(text);
+
+	redcarpet_rope_init(&rope, 16 * 1024, &rb_redcarpet_allocator);
+
+	job.ob = NULL;
+	job.rope = &rope;
+	rb_redcarpet_md__run(&job, md, renderer, text);
+
+	if (job.err < 0) {
+		redcarpet_rope_free(&rope);
+		rb_raise(rb_eNoMemError, "failed to allocate render output");
+	}
+
+	/* the block may raise, e.g. when writing fails */
+	out.rope = &rope;
+	out.enc = rb_enc_get(text);
+	rb_ensure(rb_redcarpet_rope__each, (VALUE)&out, rb_redcarpet_rope__free, (VALUE)&out);
+
+	return NIL_P(out.chunks) ? self : out.chunks;
+}
+
+struct rb_redcarpet_stream {
+	VALUE self;
+	VALUE input;
+	VALUE output;
+	struct rb_redcarpet_md *md;
+	struct sd_markdown *markdown;
+	struct buf *output_buf;
+	struct redcarpet_renderopt options;	/* the stream's own copy */
+};
+
+static VALUE rb_redcarpet_md__stream(VALUE arg)
+{
+	struct rb_redcarpet_stream *stream = (struct rb_redcarpet_stream *)arg;
+	struct buf *ob = stream->output_buf;
+	VALUE chunk, enc;
+	rb_encoding *encoding = rb_default_external_encoding();
+	int done = 0;
+
+	/* IO#read with a length gives binary data back */
+	if (rb_respond_to(stream->input, rb_intern("external_encoding"))) {
+		enc = rb_funcall(stream->input, rb_intern("external_encoding"), 0);
+		if (!NIL_P(enc))
+			encoding = rb_to_encoding(enc);
+	}
+
+	stream->options.active_enc = encoding;
+
+	while (!done) {
+		chunk = rb_funcall(stream->input, rb_intern("read"), 1, INT2FIX(16 * 1024));
+
+		if (NIL_P(chunk)) {
+			sd_markdown_finish(ob, stream->markdown);
+			done = 1;
+		} else {
+			Check_Type(chunk, T_STRING);
+			if (sd_markdown_feed(ob, (const uint8_t *)RSTRING_PTR(chunk),
+					RSTRING_LEN(chunk), stream->markdown) < 0)
+				rb_raise(rb_eNoMemError, "failed to allocate render output");
+		}
+
+		if (ob->size) {
+			rb_funcall(stream->output, rb_intern("write"), 1,
+				rb_enc_str_new((const char *)ob->data, ob->size, encoding));
+			ob->size = 0;
+		}
+	}
+
+	return stream->output;
+}
+
+static VALUE rb_redcarpet_md__stream_ensure(VALUE arg)
+{
+	struct rb_redcarpet_stream *stream = (struct rb_redcarpet_stream *)arg;
+
+	sd_markdown_reset(stream->markdown);
+	bufrelease(stream->output_buf);
+	rb_redcarpet_md__done(stream->md, stream->markdown);
+
+	return Qnil;
+}
+
+static VALUE rb_redcarpet_md_render_stream(VALUE self, VALUE input, VALUE output)
+{
+	VALUE rb_rndr;
+	struct rb_redcarpet_stream stream;
+	struct rb_redcarpet_rndr *renderer;
+
+	rb_rndr = rb_iv_get(self, "@renderer");
+
+	/* preprocess and postprocess need the whole document at once */
+	if (rb_respond_to(rb_rndr, rb_intern("preprocess")) ||
+		rb_respond_to(rb_rndr, rb_intern("postprocess"))) {
+		VALUE text = rb_redcarpet_md_render(self, rb_funcall(input, rb_intern("read"), 0));
+		if (!NIL_P(text))
+			rb_funcall(output, rb_intern("write"), 1, text);
+		return output;
+	}
+
+	stream.self = self;
+	stream.input = input;
+	stream.output = output;
+	TypedData_Get_Struct(self, struct rb_redcarpet_md, &rb_redcarpet_md__type, stream.md);
+
+	stream.output_buf = bufnew_allocator(128, BUF_GROW_DOUBLE, &rb_redcarpet_allocator);
+
+	/* reading and writing let other threads run in between, which
+	 * may render with the same renderer */
+	renderer = rb_redcarpet_rndr_unwrap(rb_rndr);
+	stream.markdown = rb_redcarpet_md__parser(stream.md, renderer, &stream.options);
+
+	return rb_ensure(rb_redcarpet_md__stream, (VALUE)&stream,
+		rb_redcarpet_md__stream_ensure, (VALUE)&stream);
+}
+
+static VALUE rb_redcarpet_md_truncated_p(VALUE self)
+{
+	struct rb_redcarpet_md *md;
+
+	TypedData_Get_Struct(self, struct rb_redcarpet_md, &rb_redcarpet_md__type, md);
+	return md->truncated ? Qtrue : Qfalse;
+}
+
+static VALUE rb_redcarpet_md_cache_stats(VALUE self)
+{
+	VALUE stats;
+	struct rb_redcarpet_md *md;
+	const struct render_cache *cache;
+
+	TypedData_Get_Struct(self, struct rb_redcarpet_md, &rb_redcarpet_md__type, md);
+
+	cache = sd_markdown_get_cache(md->markdown);
+	if (!cache)
+		return Qnil;
+
+	stats = rb_hash_new();
+	rb_hash_aset(stats, CSTR2SYM("hits"), SIZET2NUM(cache->hits));
+	rb_hash_aset(stats, CSTR2SYM("misses"), SIZET2NUM(cache->misses));
+	rb_hash_aset(stats, CSTR2SYM("evictions"), SIZET2NUM(cache->evictions));
+	rb_hash_aset(stats, CSTR2SYM("entries"), SIZET2NUM(cache->entries));
+	rb_hash_aset(stats, CSTR2SYM("bytes"), SIZET2NUM(cache->bytes));
+
+	return stats;
+}
+
+struct rb_redcarpet_doc {
+	struct sd_tree *tree;
+	rb_encoding *enc;
+};
+
+static void
+rb_redcarpet_doc__free(void *ptr)
+{
+	struct rb_redcarpet_doc *doc = ptr;
+	sd_tree_free(doc->tree);
+	xfree(doc);
+}
+
+static size_t
+rb_redcarpet_doc__memsize(const void *ptr)
+{
+	const struct rb_redcarpet_doc *doc = ptr;
+	return sizeof(*doc) + doc->tree->text_size + doc->tree->extra->asize;
+}
+
+static const rb_data_type_t rb_redcarpet_doc__type = {
+	"Redcarpet/document",
+	{
+		NULL, // Nothing to mark
+		rb_redcarpet_doc__free,
+		rb_redcarpet_doc__memsize,
+	},
+	0,
+	0,
+	RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
+};
+
+static VALUE rb_redcarpet_md_parse(VALUE self, VALUE text)
+{
+	VALUE rb_rndr, rb_doc;
+	struct rb_redcarpet_job job;
+	struct rb_redcarpet_md *md;
+	struct rb_redcarpet_rndr *renderer;
+	struct rb_redcarpet_doc *doc;
+
+	Check_Type(text, T_STRING);
+
+	rb_rndr = rb_iv_get(self, "@renderer");
+	TypedData_Get_Struct(self, struct rb_redcarpet_md, &rb_redcarpet_md__type, md);
+
+	if (rb_respond_to(rb_rndr, rb_intern("preprocess")))
+		text = rb_funcall(rb_rndr, rb_intern("preprocess"), 1, text);
+	if (NIL_P(text))
+		return Qnil;
+
+	Check_Type(text, T_STRING);
+
+	rb_doc = TypedData_Make_Struct(rb_cDocument, struct rb_redcarpet_doc, &rb_redcarpet_doc__type, doc);
+	doc->enc = rb_enc_get(text);
+
+	renderer = rb_redcarpet_rndr_unwrap(rb_rndr);
+	job.ob = NULL;
+	job.rope = NULL;
+	rb_redcarpet_md__run(&job, md, renderer, text);
+	doc->tree = job.tree;
+
+	if (!doc->tree)
+		rb_raise(rb_eNoMemError, "failed to allocate document tree");
+
+	return rb_doc;
+}
+
+static VALUE rb_redcarpet_doc_render(VALUE self, VALUE rb_rndr)
+{
+	VALUE text;
+	struct buf *output_buf;
+	struct rb_redcarpet_doc *doc;
+	struct rb_redcarpet_rndr *renderer;
+
+	TypedData_Get_Struct(self, struct rb_redcarpet_doc, &rb_redcarpet_doc__type, doc);
+
+	if (rb_obj_is_kind_of(rb_rndr, rb_cClass))
+		rb_rndr = rb_funcall(rb_rndr, rb_intern("new"), 0);
+
+	if (!rb_obj_is_kind_of(rb_rndr, rb_cRenderBase))
+		rb_raise(rb_eTypeError, "Invalid Renderer instance given");
+
+	renderer = rb_redcarpet_rndr_unwrap(rb_rndr);
+	renderer->options.active_enc = doc->enc;
+
+	output_buf = bufnew_allocator(128, BUF_GROW_DOUBLE, &rb_redcarpet_allocator);
+
+	sd_tree_render(output_buf, doc->tree, &renderer->callbacks, &renderer->options);
+
+	text = rb_enc_str_new((const char*)output_buf->data, output_buf->size, doc->enc);
 
 	bufrelease(output_buf);
 
@@ -189,6 +1064,17 @@ void Init_redcarpet()
 	rb_undef_alloc_func(rb_cMarkdown);
 	rb_define_singleton_method(rb_cMarkdown, "new", rb_redcarpet_md__new, -1);
 	rb_define_method(rb_cMarkdown, "render", rb_redcarpet_md_render, 1);
+	rb_define_method(rb_cMarkdown, "render_incremental", rb_redcarpet_md_render_incremental, 1);
+	rb_define_method(rb_cMarkdown, "render_many", rb_redcarpet_md_render_many, 1);
+	rb_define_method(rb_cMarkdown, "render_chunks", rb_redcarpet_md_render_chunks, 1);
+	rb_define_method(rb_cMarkdown, "render_stream", rb_redcarpet_md_render_stream, 2);
+	rb_define_method(rb_cMarkdown, "parse", rb_redcarpet_md_parse, 1);
+	rb_define_method(rb_cMarkdown, "cache_stats", rb_redcarpet_md_cache_stats, 0);
+	rb_define_method(rb_cMarkdown, "truncated?", rb_redcarpet_md_truncated_p, 0);
+
+	rb_cDocument = rb_define_class_under(rb_mRedcarpet, "Document", rb_cObject);
+	rb_undef_alloc_func(rb_cDocument);
+	rb_define_method(rb_cDocument, "render", rb_redcarpet_doc_render, 1);
 
 	Init_redcarpet_rndr();
 }
@@ -402,6 +402,26 @@ struct rb_redcarpet_rndr * rb_redcarpet_rndr_unwrap(VALUE self)
 	return rndr;
 }
 
+/* Whether the renderer can be called without the GVL: none of its
+ * callbacks are Ruby methods */
+int rb_redcarpet_rndr_native(VALUE self)
+{
+	struct rb_redcarpet_rndr *rndr = rb_redcarpet_rndr_unwrap(self);
+	void **source = (void **)&rb_redcarpet_callbacks;
+	void **dest = (void **)&rndr->callbacks;
+	size_t i;
+
+	if (rndr->options.html.link_attributes)
+		return 0;
+
+	for (i = 0; i < rb_redcarpet_method_count; ++i) {
+		if (dest[i] && dest[i] == source[i])
+			return 0;
+	}
+
+	return 1;
+}
+
 static VALUE rb_redcarpet_rbase_alloc(VALUE klass)
 {
 	struct rb_redcarpet_rndr *rndr = ALLOC(struct rb_redcarpet_rndr);
@@ -573,7 +593,7 @@ static VALUE rb_redcarpet_smartypants_render(VALUE self, VALUE text)
 
 	Check_Type(text, T_STRING);
 
-	output_buf = bufnew(128);
+	output_buf = bufnew_allocator(128, BUF_GROW_DOUBLE, &rb_redcarpet_allocator);
 
 	sdhtml_smartypants(output_buf, (const uint8_t*)RSTRING_PTR(text), RSTRING_LEN(text));
 	result = rb_enc_str_new((const char*)output_buf->data, output_buf->size, rb_enc_get(text));
@@ -50,5 +50,8 @@ struct rb_redcarpet_rndr {
 };
 
 struct rb_redcarpet_rndr * rb_redcarpet_rndr_unwrap(VALUE);
+int rb_redcarpet_rndr_native(VALUE);
+
+extern const struct sd_allocator rb_redcarpet_allocator;
 
 #endif
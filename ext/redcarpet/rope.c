@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "rope.h"
+#include <string.h>
+
+void
+redcarpet_rope_init(struct rope *rope, size_t chunk_size, const struct sd_allocator *allocator)
+{
+	rope->head = rope->tail = NULL;
+	rope->size = 0;
+	rope->allocator = allocator;
+
+	if (!chunk_size)
+		chunk_size = 16 * 1024;
+
+	rope->chunk_size = chunk_size;
+}
+
+static struct rope_chunk *
+rope_chunk_new(struct rope *rope)
+{
+	struct rope_chunk *chunk;
+
+	chunk = sd_malloc(rope->allocator, sizeof(struct rope_chunk) + rope->chunk_size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->data = (uint8_t *)(chunk + 1);
+	chunk->size = 0;
+
+	if (rope->tail)
+		rope->tail->next = chunk;
+	else
+		rope->head = chunk;
+
+	rope->tail = chunk;
+	return chunk;
+}
+
+int
+redcarpet_rope_put(struct rope *rope, const void *data, size_t len)
+{
+	const uint8_t *src = data;
+	struct rope_chunk *chunk = rope->tail;
+	size_t room;
+
+	while (len > 0) {
+		if (!chunk || chunk->size == rope->chunk_size) {
+			chunk = rope_chunk_new(rope);
+			if (!chunk)
+				return BUF_ENOMEM;
+		}
+
+		room = rope->chunk_size - chunk->size;
+		if (room > len)
+			room = len;
+
+		memcpy(chunk->data + chunk->size, src, room);
+		chunk->size += room;
+		rope->size += room;
+		src += room;
+		len -= room;
+	}
+
+	return BUF_OK;
+}
+
+void
+redcarpet_rope_shift(struct rope *rope)
+{
+	struct rope_chunk *chunk = rope->head;
+
+	if (!chunk)
+		return;
+
+	rope->head = chunk->next;
+	if (!rope->head)
+		rope->tail = NULL;
+
+	rope->size -= chunk->size;
+	sd_free(rope->allocator, chunk);
+}
+
+void
+redcarpet_rope_free(struct rope *rope)
+{
+	struct rope_chunk *chunk, *next;
+
+	for (chunk = rope->head; chunk; chunk = next) {
+		next = chunk->next;
+		sd_free(rope->allocator, chunk);
+	}
+
+	rope->head = rope->tail = NULL;
+	rope->size = 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef ROPE_H__
+#define ROPE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* struct rope_chunk: one fixed-size block of output */
+struct rope_chunk {
+	struct rope_chunk *next;
+	uint8_t *data;
+	size_t size;	/* bytes used in data */
+};
+
+/* struct rope: output kept as a list of chunks, never moved once written */
+struct rope {
+	struct rope_chunk *head;
+	struct rope_chunk *tail;
+	size_t size;	/* total bytes over all chunks */
+	size_t chunk_size;
+	const struct sd_allocator *allocator;
+};
+
+/* redcarpet_rope_init: initialization of an empty rope */
+void redcarpet_rope_init(struct rope *, size_t, const struct sd_allocator *);
+
+/* redcarpet_rope_put: appends raw data to the rope */
+int redcarpet_rope_put(struct rope *, const void *, size_t);
+
+/* redcarpet_rope_shift: release of the first chunk, once it has been used */
+void redcarpet_rope_shift(struct rope *);
+
+/* redcarpet_rope_free: release of every chunk */
+void redcarpet_rope_free(struct rope *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
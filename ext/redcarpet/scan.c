@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "scan.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define SCAN_X86 1
+# include <immintrin.h>
+#endif
+
+static size_t
+find_scalar(const struct scanner *sc, const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size && sc->table[data[i]] == 0)
+		i++;
+
+	return i;
+}
+
+#ifdef SCAN_X86
+/* The vector scans classify every byte with two table lookups: each
+ * distinct high nibble of the set gets a bit, set in hi_nibbles for that
+ * nibble and in lo_nibbles for the low nibbles it is paired with, so a
+ * byte belongs to the set exactly when both lookups share a bit */
+
+__attribute__((target("ssse3")))
+static size_t
+find_ssse3(const struct scanner *sc, const uint8_t *data, size_t size)
+{
+	const __m128i lo = _mm_loadu_si128((const __m128i *)sc->lo_nibbles);
+	const __m128i hi = _mm_loadu_si128((const __m128i *)sc->hi_nibbles);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble));
+		__m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+		int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), zero)) & 0xffff;
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + find_scalar(sc, data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+find_avx2(const struct scanner *sc, const uint8_t *data, size_t size)
+{
+	const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)sc->lo_nibbles));
+	const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)sc->hi_nibbles));
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+		__m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+		unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(l, h), zero));
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + find_ssse3(sc, data + i, size - i);
+}
+#endif
+
+/* scanner_classify • fills in the nibble tables; 0 when the set spans
+ * more high nibbles than there are bits to tell them apart */
+static int
+scanner_classify(struct scanner *sc)
+{
+	int bit[16], next = 0, c;
+
+	memset(bit, -1, sizeof(bit));
+	memset(sc->lo_nibbles, 0, sizeof(sc->lo_nibbles));
+	memset(sc->hi_nibbles, 0, sizeof(sc->hi_nibbles));
+
+	for (c = 0; c < 256; ++c) {
+		if (!sc->table[c])
+			continue;
+
+		if (bit[c >> 4] < 0) {
+			if (next == 8)
+				return 0;
+			bit[c >> 4] = next++;
+			sc->hi_nibbles[c >> 4] = 1 << bit[c >> 4];
+		}
+
+		sc->lo_nibbles[c & 0x0f] |= 1 << bit[c >> 4];
+	}
+
+	return 1;
+}
+
+void
+redcarpet_scanner_init(struct scanner *sc, const uint8_t *table)
+{
+	sc->table = table;
+	sc->find = find_scalar;
+
+	if (!scanner_classify(sc))
+		return;
+
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		sc->find = find_avx2;
+	else if (__builtin_cpu_supports("ssse3"))
+		sc->find = find_ssse3;
+#endif
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SCAN_H__
+#define SCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* struct scanner: finds the next byte of a set, several bytes at a time
+ * where the CPU allows it */
+struct scanner {
+	const uint8_t *table;	/* non-zero for the bytes of the set */
+	uint8_t lo_nibbles[16];	/* classes of each low nibble... */
+	uint8_t hi_nibbles[16];	/* ...and of each high nibble, for the vector scans */
+	size_t (*find)(const struct scanner *, const uint8_t *, size_t);
+};
+
+void redcarpet_scanner_init(struct scanner *, const uint8_t *table);
+
+/* redcarpet_scanner_find • offset of the first byte of the set in data,
+ * or size when there is none */
+static inline size_t
+redcarpet_scanner_find(const struct scanner *sc, const uint8_t *data, size_t size)
+{
+	size_t i;
+
+	/* short runs are over before a vector scan would pay off */
+	for (i = 0; i < size && i < 16; ++i)
+		if (sc->table[data[i]])
+			return i;
+
+	if (i == size)
+		return size;
+
+	return i + sc->find(sc, data + i, size - i);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -31,7 +31,7 @@ redcarpet_stack_grow(struct stack *st, size_t new_size)
 	if (st->asize >= new_size)
 		return 0;
 
-	new_st = realloc(st->item, new_size * sizeof(void *));
+	new_st = sd_realloc(st->allocator, st->item, new_size * sizeof(void *));
 	if (new_st == NULL)
 		return -1;
 
@@ -53,7 +53,7 @@ redcarpet_stack_free(struct stack *st)
 	if (!st)
 		return;
 
-	free(st->item);
+	sd_free(st->allocator, st->item);
 
 	st->item = NULL;
 	st->size = 0;
@@ -61,11 +61,12 @@ redcarpet_stack_free(struct stack *st)
 }
 
 int
-redcarpet_stack_init(struct stack *st, size_t initial_size)
+redcarpet_stack_init(struct stack *st, size_t initial_size, const struct sd_allocator *allocator)
 {
 	st->item = NULL;
 	st->size = 0;
 	st->asize = 0;
+	st->allocator = allocator;
 
 	if (!initial_size)
 		initial_size = 8;
@@ -24,6 +24,7 @@
 #define STACK_H__
 
 #include <stdlib.h>
+#include "buffer.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,11 +34,12 @@ struct stack {
 	void **item;
 	size_t size;
 	size_t asize;
+	const struct sd_allocator *allocator;
 };
 
 void redcarpet_stack_free(struct stack *);
 int redcarpet_stack_grow(struct stack *, size_t);
-int redcarpet_stack_init(struct stack *, size_t);
+int redcarpet_stack_init(struct stack *, size_t, const struct sd_allocator *);
 
 int redcarpet_stack_push(struct stack *, void *);
 
@@ -0,0 +1,868 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tree.h"
+#include "stack.h"
+#include <string.h>
+
+#define HANDLE_SIZE sizeof(struct sd_node *)
+
+struct tree_walk {
+	const struct sd_tree *tree;
+	const struct sd_callbacks *cb;
+	void *opaque;
+	struct stack bufs;
+	struct buf *out;	/* for a dry run, the output to throw away */
+};
+
+static int walk_callback(struct buf *ob, struct tree_walk *w, const struct sd_node *node);
+
+/*******************
+ * BUILDING A TREE *
+ *******************/
+
+/* While a tree is being built, the parser's output buffers hold handles
+ * to nodes rather than rendered text: every callback below turns the
+ * handles it is given into the children of a new node, and writes the
+ * handle of that node into its own output */
+
+static void
+tree_slice(struct sd_tree *tree, struct sd_slice *slice, const struct buf *buf)
+{
+	size_t offset;
+
+	if (!buf) {
+		slice->offset = SD_SLICE_NONE;
+		slice->size = 0;
+		return;
+	}
+
+	if (buf->data >= tree->text && buf->data + buf->size <= tree->text + tree->text_size) {
+		offset = buf->data - tree->text;
+	} else {
+		offset = tree->text_size + tree->extra->size;
+		if (offset + buf->size >= SD_SLICE_NONE) {
+			slice->offset = SD_SLICE_NONE;
+			slice->size = 0;
+			return;
+		}
+
+		bufput(tree->extra, buf->data, buf->size);
+	}
+
+	slice->offset = (uint32_t)offset;
+	slice->size = (uint32_t)buf->size;
+}
+
+static struct sd_node *
+tree_alloc(struct sd_tree *tree, enum sd_node_type type, unsigned int flags)
+{
+	struct sd_node *node = redcarpet_arena_calloc(&tree->arena, 1, sizeof(struct sd_node));
+
+	if (!node)
+		return NULL;
+
+	node->type = type;
+	node->flags = flags;
+	node->slices[0].offset = node->slices[1].offset = node->slices[2].offset = SD_SLICE_NONE;
+	node->source.offset = SD_SLICE_NONE;
+	return node;
+}
+
+static struct sd_node *
+tree_node(struct buf *ob, struct sd_tree *tree, enum sd_node_type type, unsigned int flags)
+{
+	struct sd_node *node = tree_alloc(tree, type, flags);
+
+	if (node)
+		bufput(ob, &node, HANDLE_SIZE);
+	return node;
+}
+
+static struct sd_node *
+tree_last_node(const struct buf *ob)
+{
+	struct sd_node *node;
+
+	if (ob->size < HANDLE_SIZE)
+		return NULL;
+
+	memcpy(&node, ob->data + ob->size - HANDLE_SIZE, HANDLE_SIZE);
+	return node;
+}
+
+/* redcarpet_tree_nodes • links up the nodes whose handles are in buf */
+struct sd_node *
+redcarpet_tree_nodes(struct sd_tree *tree, const struct buf *buf)
+{
+	struct sd_node *first = NULL, *last = NULL, *node;
+	size_t i;
+
+	if (!buf)
+		return NULL;
+
+	for (i = 0; i + HANDLE_SIZE <= buf->size; i += HANDLE_SIZE) {
+		memcpy(&node, buf->data + i, HANDLE_SIZE);
+		node->next = NULL;
+
+		if (last)
+			last->next = node;
+		else
+			first = node;
+		last = node;
+	}
+
+	return first;
+}
+
+static struct sd_node *
+tree_parent(struct buf *ob, const struct buf *text, enum sd_node_type type, unsigned int flags, void *opaque)
+{
+	struct sd_tree *tree = opaque;
+	struct sd_node *node = tree_node(ob, tree, type, flags);
+
+	if (node)
+		node->children = redcarpet_tree_nodes(tree, text);
+	return node;
+}
+
+static struct sd_node *
+tree_leaf(struct buf *ob, const struct buf *a, const struct buf *b, const struct buf *c,
+	enum sd_node_type type, unsigned int flags, void *opaque)
+{
+	struct sd_tree *tree = opaque;
+	struct sd_node *node = tree_node(ob, tree, type, flags);
+
+	if (node) {
+		tree_slice(tree, &node->slices[0], a);
+		tree_slice(tree, &node->slices[1], b);
+		tree_slice(tree, &node->slices[2], c);
+	}
+
+	return node;
+}
+
+/* tree_span • whether the renderer the tree is built for takes the span
+ * just recorded: its callback runs on the rendered children, into a
+ * buffer which is thrown away. When it declines, the node is taken back
+ * and the parser goes on as it would have with that renderer */
+static int
+tree_span(struct buf *ob, struct sd_tree *tree, const struct sd_node *node)
+{
+	struct tree_walk *w = tree->dry;
+	int ret;
+
+	if (!node || !tree->renderer)
+		return 1;
+
+	if (!w) {
+		w = sd_malloc(tree->arena.allocator, sizeof(struct tree_walk));
+		if (!w)
+			return 1;
+
+		w->tree = tree;
+		w->cb = tree->renderer;
+		w->opaque = tree->renderer_opaque;
+		w->out = bufnew_allocator(64, BUF_GROW_DOUBLE, tree->arena.allocator);
+		if (!w->out || redcarpet_stack_init(&w->bufs, 8, tree->arena.allocator) < 0) {
+			bufrelease(w->out);
+			sd_free(tree->arena.allocator, w);
+			return 1;
+		}
+		tree->dry = w;
+	}
+
+	w->out->size = 0;
+	ret = walk_callback(w->out, w, node);
+	w->bufs.size = 0;
+
+	if (!ret)
+		ob->size -= HANDLE_SIZE;
+	return ret;
+}
+
+static void
+tree_blockcode(struct buf *ob, const struct buf *text, const struct buf *lang, void *opaque)
+{
+	tree_leaf(ob, text, lang, NULL, SD_NODE_BLOCKCODE, 0, opaque);
+}
+
+static void
+tree_blockquote(struct buf *ob, const struct buf *text, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_BLOCKQUOTE, 0, opaque);
+}
+
+static void
+tree_blockhtml(struct buf *ob, const struct buf *text, void *opaque)
+{
+	tree_leaf(ob, text, NULL, NULL, SD_NODE_BLOCKHTML, 0, opaque);
+}
+
+static void
+tree_header(struct buf *ob, const struct buf *text, int level, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_HEADER, level, opaque);
+}
+
+static void
+tree_hrule(struct buf *ob, void *opaque)
+{
+	tree_node(ob, opaque, SD_NODE_HRULE, 0);
+}
+
+static void
+tree_list(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_LIST, flags, opaque);
+}
+
+static void
+tree_listitem(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_LISTITEM, flags, opaque);
+}
+
+static void
+tree_paragraph(struct buf *ob, const struct buf *text, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_PARAGRAPH, 0, opaque);
+}
+
+static void
+tree_table(struct buf *ob, const struct buf *header, const struct buf *body, void *opaque)
+{
+	struct sd_tree *tree = opaque;
+	struct sd_node *node = tree_node(ob, tree, SD_NODE_TABLE, 0);
+	struct sd_node *head, *rows;
+
+	if (!node)
+		return;
+
+	head = tree_alloc(tree, SD_NODE_GROUP, 0);
+	rows = tree_alloc(tree, SD_NODE_GROUP, 0);
+	if (!head || !rows)
+		return;
+
+	head->children = redcarpet_tree_nodes(tree, header);
+	rows->children = redcarpet_tree_nodes(tree, body);
+	head->next = rows;
+	node->children = head;
+}
+
+static void
+tree_table_row(struct buf *ob, const struct buf *text, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_TABLE_ROW, 0, opaque);
+}
+
+static void
+tree_table_cell(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_TABLE_CELL, flags, opaque);
+}
+
+static void
+tree_footnotes(struct buf *ob, const struct buf *text, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_FOOTNOTES, 0, opaque);
+}
+
+static void
+tree_footnote_def(struct buf *ob, const struct buf *text, unsigned int num, void *opaque)
+{
+	tree_parent(ob, text, SD_NODE_FOOTNOTE_DEF, num, opaque);
+}
+
+static int
+tree_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, void *opaque)
+{
+	return tree_span(ob, opaque, tree_leaf(ob, link, NULL, NULL, SD_NODE_AUTOLINK, type, opaque));
+}
+
+static int
+tree_codespan(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_leaf(ob, text, NULL, NULL, SD_NODE_CODESPAN, 0, opaque));
+}
+
+static int
+tree_double_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_parent(ob, text, SD_NODE_DOUBLE_EMPHASIS, 0, opaque));
+}
+
+static int
+tree_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_parent(ob, text, SD_NODE_EMPHASIS, 0, opaque));
+}
+
+static int
+tree_underline(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_parent(ob, text, SD_NODE_UNDERLINE, 0, opaque));
+}
+
+static int
+tree_highlight(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_parent(ob, text, SD_NODE_HIGHLIGHT, 0, opaque));
+}
+
+static int
+tree_quote(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_leaf(ob, text, NULL, NULL, SD_NODE_QUOTE, 0, opaque));
+}
+
+static int
+tree_image(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *alt, void *opaque)
+{
+	return tree_span(ob, opaque, tree_leaf(ob, link, title, alt, SD_NODE_IMAGE, 0, opaque));
+}
+
+static int
+tree_linebreak(struct buf *ob, void *opaque)
+{
+	return tree_span(ob, opaque, tree_node(ob, opaque, SD_NODE_LINEBREAK, 0));
+}
+
+static int
+tree_link(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *content, void *opaque)
+{
+	struct sd_node *node = tree_leaf(ob, link, title, NULL, SD_NODE_LINK, 0, opaque);
+
+	if (node)
+		node->children = redcarpet_tree_nodes(opaque, content);
+	return tree_span(ob, opaque, node);
+}
+
+static int
+tree_raw_html_tag(struct buf *ob, const struct buf *tag, void *opaque)
+{
+	return tree_span(ob, opaque, tree_leaf(ob, tag, NULL, NULL, SD_NODE_RAW_HTML, 0, opaque));
+}
+
+static int
+tree_triple_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_parent(ob, text, SD_NODE_TRIPLE_EMPHASIS, 0, opaque));
+}
+
+static int
+tree_strikethrough(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_parent(ob, text, SD_NODE_STRIKETHROUGH, 0, opaque));
+}
+
+static int
+tree_superscript(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return tree_span(ob, opaque, tree_parent(ob, text, SD_NODE_SUPERSCRIPT, 0, opaque));
+}
+
+static int
+tree_footnote_ref(struct buf *ob, unsigned int num, void *opaque)
+{
+	return tree_span(ob, opaque, tree_node(ob, opaque, SD_NODE_FOOTNOTE_REF, num));
+}
+
+static void
+tree_entity(struct buf *ob, const struct buf *entity, void *opaque)
+{
+	tree_leaf(ob, entity, NULL, NULL, SD_NODE_ENTITY, 0, opaque);
+}
+
+static void
+tree_normal_text(struct buf *ob, const struct buf *text, void *opaque)
+{
+	tree_leaf(ob, text, NULL, NULL, SD_NODE_TEXT, 0, opaque);
+}
+
+/* redcarpet_tree_callbacks • the recorder's callbacks for the constructs
+ * the given renderer handles, so that the tree has the same shape as the
+ * renderer's own output would */
+void
+redcarpet_tree_callbacks(struct sd_callbacks *cb, const struct sd_callbacks *renderer)
+{
+#define RECORD(name) cb->name = renderer->name ? tree_##name : NULL
+	RECORD(blockcode);
+	RECORD(blockquote);
+	RECORD(blockhtml);
+	RECORD(header);
+	RECORD(hrule);
+	RECORD(list);
+	RECORD(listitem);
+	RECORD(paragraph);
+	RECORD(table);
+	RECORD(table_row);
+	RECORD(table_cell);
+	RECORD(footnotes);
+	RECORD(footnote_def);
+	RECORD(autolink);
+	RECORD(codespan);
+	RECORD(double_emphasis);
+	RECORD(emphasis);
+	RECORD(underline);
+	RECORD(highlight);
+	RECORD(quote);
+	RECORD(image);
+	RECORD(linebreak);
+	RECORD(link);
+	RECORD(raw_html_tag);
+	RECORD(triple_emphasis);
+	RECORD(strikethrough);
+	RECORD(superscript);
+	RECORD(footnote_ref);
+#undef RECORD
+
+	/* the text in between has to be recorded either way */
+	cb->entity = tree_entity;
+	cb->normal_text = tree_normal_text;
+
+	cb->doc_header = NULL;
+	cb->doc_footer = NULL;
+}
+
+struct sd_tree *
+redcarpet_tree_new(const struct sd_allocator *allocator)
+{
+	struct sd_tree *tree = sd_malloc(allocator, sizeof(struct sd_tree));
+
+	if (!tree)
+		return NULL;
+
+	memset(tree, 0x0, sizeof(struct sd_tree));
+	redcarpet_arena_init(&tree->arena, 16384, allocator);
+
+	tree->extra = bufnew_allocator(256, BUF_GROW_DOUBLE, allocator);
+	if (!tree->extra) {
+		sd_tree_free(tree);
+		return NULL;
+	}
+
+	return tree;
+}
+
+/* redcarpet_tree_renderer • sets the renderer whose span callbacks decide
+ * which spans are kept, or with NULL, releases what deciding took */
+void
+redcarpet_tree_renderer(struct sd_tree *tree, const struct sd_callbacks *renderer, void *opaque)
+{
+	struct tree_walk *w = tree->dry;
+	size_t i;
+
+	tree->renderer = renderer;
+	tree->renderer_opaque = opaque;
+
+	if (renderer || !w)
+		return;
+
+	for (i = 0; i < w->bufs.asize; ++i)
+		bufrelease(w->bufs.item[i]);
+	redcarpet_stack_free(&w->bufs);
+	bufrelease(w->out);
+	sd_free(tree->arena.allocator, w);
+	tree->dry = NULL;
+}
+
+/* redcarpet_tree_set_text • keeps a copy of the document to parse, which
+ * the nodes will point into */
+int
+redcarpet_tree_set_text(struct sd_tree *tree, const uint8_t *text, size_t size)
+{
+	if (size >= SD_SLICE_NONE / 2)
+		return 0;
+
+	tree->text = redcarpet_arena_alloc(&tree->arena, size ? size : 1);
+	if (!tree->text)
+		return 0;
+
+	memcpy(tree->text, text, size);
+	tree->text_size = size;
+	return 1;
+}
+
+/* redcarpet_tree_rewind • takes back the last size bytes of text written
+ * to ob, the way the parser shortens its output */
+void
+redcarpet_tree_rewind(struct sd_tree *tree, struct buf *ob, size_t size)
+{
+	struct sd_node *node;
+
+	while ((node = tree_last_node(ob)) != NULL && node->type == SD_NODE_TEXT) {
+		if (node->slices[0].size > size) {
+			node->slices[0].size -= size;
+			tree->rewound += size;
+			return;
+		}
+
+		size -= node->slices[0].size;
+		tree->rewound += node->slices[0].size;
+		ob->size -= HANDLE_SIZE;
+
+		if (!size)
+			return;
+	}
+}
+
+/* redcarpet_tree_last_char • the last byte of text written to ob, or -1 */
+int
+redcarpet_tree_last_char(struct sd_tree *tree, const struct buf *ob)
+{
+	const struct sd_node *node;
+	size_t end = ob->size;
+	uint32_t offset;
+
+	while (end >= HANDLE_SIZE) {
+		memcpy(&node, ob->data + end - HANDLE_SIZE, HANDLE_SIZE);
+		if (node->type != SD_NODE_TEXT || node->slices[0].offset == SD_SLICE_NONE)
+			return -1;
+
+		if (node->slices[0].size) {
+			offset = node->slices[0].offset + node->slices[0].size - 1;
+			return offset < tree->text_size ?
+				tree->text[offset] : tree->extra->data[offset - tree->text_size];
+		}
+
+		end -= HANDLE_SIZE;
+	}
+
+	return -1;
+}
+
+/* redcarpet_tree_span • records the markup of the span just written to
+ * ob, including whatever text the parser took back for it */
+void
+redcarpet_tree_span(struct sd_tree *tree, struct buf *ob, const uint8_t *data, size_t size)
+{
+	struct sd_node *node = tree_last_node(ob);
+	struct buf source;
+
+	if (node && node->type >= SD_NODE_AUTOLINK && node->type <= SD_NODE_FOOTNOTE_REF &&
+		node->source.offset == SD_SLICE_NONE) {
+		source.data = (uint8_t *)data - tree->rewound;
+		source.size = size + tree->rewound;
+		tree_slice(tree, &node->source, &source);
+	}
+
+	tree->rewound = 0;
+}
+
+void
+sd_tree_free(struct sd_tree *tree)
+{
+	if (!tree)
+		return;
+
+	redcarpet_tree_renderer(tree, NULL, NULL);
+	bufrelease(tree->extra);
+	redcarpet_arena_free(&tree->arena);
+	sd_free(tree->arena.allocator, tree);
+}
+
+/********************
+ * REPLAYING A TREE *
+ ********************/
+
+static struct buf *
+walk_newbuf(struct tree_walk *w)
+{
+	struct buf *work;
+
+	if (w->bufs.size < w->bufs.asize && w->bufs.item[w->bufs.size] != NULL) {
+		work = w->bufs.item[w->bufs.size++];
+		work->size = 0;
+	} else {
+		work = bufnew_allocator(64, BUF_GROW_DOUBLE, w->bufs.allocator);
+		redcarpet_stack_push(&w->bufs, work);
+	}
+
+	return work;
+}
+
+static const struct buf *
+walk_slice(struct tree_walk *w, struct buf *buf, const struct sd_slice *slice)
+{
+	const struct sd_tree *tree = w->tree;
+
+	if (slice->offset == SD_SLICE_NONE)
+		return NULL;
+
+	buf->data = slice->offset < tree->text_size ?
+		tree->text + slice->offset :
+		tree->extra->data + (slice->offset - tree->text_size);
+	buf->size = slice->size;
+	buf->asize = 0;
+	/* the callbacks only read it, but some (bufprefix) insist on
+	 * a buffer which looks writable, as the parser's work buffers do */
+	buf->unit = 1;
+	return buf;
+}
+
+static void
+walk_text(struct buf *ob, struct tree_walk *w, const struct sd_slice *slice)
+{
+	struct buf work = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
+
+	if (!walk_slice(w, &work, slice))
+		return;
+
+	if (w->cb->normal_text)
+		w->cb->normal_text(ob, &work, w->opaque);
+	else
+		bufput(ob, work.data, work.size);
+}
+
+static void walk_nodes(struct buf *ob, struct tree_walk *w, const struct sd_node *node);
+
+/* walk_children • renders the children of node into a new work buffer */
+static struct buf *
+walk_children(struct tree_walk *w, const struct sd_node *node)
+{
+	struct buf *content = walk_newbuf(w);
+
+	walk_nodes(content, w, node);
+	return content;
+}
+
+/* walk_callback • calls the callback for node, returning whether it took
+ * it (always for blocks) */
+static int
+walk_callback(struct buf *ob, struct tree_walk *w, const struct sd_node *node)
+{
+	const struct sd_callbacks *cb = w->cb;
+	void *opaque = w->opaque;
+	struct buf a = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL }, b = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL }, c = { 0, 0, 0, 0, BUF_GROW_UNIT, NULL };
+	struct buf *content = NULL, *body;
+	int ret = 1;
+
+	switch (node->type) {
+	case SD_NODE_BLOCKCODE:
+		if (cb->blockcode)
+			cb->blockcode(ob, walk_slice(w, &a, &node->slices[0]), walk_slice(w, &b, &node->slices[1]), opaque);
+		break;
+
+	case SD_NODE_BLOCKQUOTE:
+		content = walk_children(w, node->children);
+		if (cb->blockquote)
+			cb->blockquote(ob, content, opaque);
+		break;
+
+	case SD_NODE_BLOCKHTML:
+		if (cb->blockhtml)
+			cb->blockhtml(ob, walk_slice(w, &a, &node->slices[0]), opaque);
+		break;
+
+	case SD_NODE_HEADER:
+		content = walk_children(w, node->children);
+		if (cb->header)
+			cb->header(ob, content, node->flags, opaque);
+		break;
+
+	case SD_NODE_HRULE:
+		if (cb->hrule)
+			cb->hrule(ob, opaque);
+		break;
+
+	case SD_NODE_LIST:
+		content = walk_children(w, node->children);
+		if (cb->list)
+			cb->list(ob, content, node->flags, opaque);
+		break;
+
+	case SD_NODE_LISTITEM:
+		content = walk_children(w, node->children);
+		if (cb->listitem)
+			cb->listitem(ob, content, node->flags, opaque);
+		break;
+
+	case SD_NODE_PARAGRAPH:
+		content = walk_children(w, node->children);
+		if (cb->paragraph)
+			cb->paragraph(ob, content, opaque);
+		break;
+
+	case SD_NODE_TABLE:
+		content = walk_children(w, node->children ? node->children->children : NULL);
+		body = walk_children(w, node->children && node->children->next ? node->children->next->children : NULL);
+		if (cb->table)
+			cb->table(ob, content, body, opaque);
+		break;
+
+	case SD_NODE_TABLE_ROW:
+		content = walk_children(w, node->children);
+		if (cb->table_row)
+			cb->table_row(ob, content, opaque);
+		break;
+
+	case SD_NODE_TABLE_CELL:
+		content = walk_children(w, node->children);
+		if (cb->table_cell)
+			cb->table_cell(ob, content, node->flags, opaque);
+		break;
+
+	case SD_NODE_FOOTNOTES:
+		content = walk_children(w, node->children);
+		if (cb->footnotes)
+			cb->footnotes(ob, content, opaque);
+		break;
+
+	case SD_NODE_FOOTNOTE_DEF:
+		content = walk_children(w, node->children);
+		if (cb->footnote_def)
+			cb->footnote_def(ob, content, node->flags, opaque);
+		break;
+
+	case SD_NODE_AUTOLINK:
+		ret = cb->autolink && cb->autolink(ob, walk_slice(w, &a, &node->slices[0]), node->flags, opaque);
+		break;
+
+	case SD_NODE_CODESPAN:
+		ret = cb->codespan && cb->codespan(ob, walk_slice(w, &a, &node->slices[0]), opaque);
+		break;
+
+	case SD_NODE_DOUBLE_EMPHASIS:
+		content = walk_children(w, node->children);
+		ret = cb->double_emphasis && cb->double_emphasis(ob, content, opaque);
+		break;
+
+	case SD_NODE_EMPHASIS:
+		content = walk_children(w, node->children);
+		ret = cb->emphasis && cb->emphasis(ob, content, opaque);
+		break;
+
+	case SD_NODE_UNDERLINE:
+		content = walk_children(w, node->children);
+		ret = cb->underline && cb->underline(ob, content, opaque);
+		break;
+
+	case SD_NODE_HIGHLIGHT:
+		content = walk_children(w, node->children);
+		ret = cb->highlight && cb->highlight(ob, content, opaque);
+		break;
+
+	case SD_NODE_QUOTE:
+		ret = cb->quote && cb->quote(ob, walk_slice(w, &a, &node->slices[0]), opaque);
+		break;
+
+	case SD_NODE_IMAGE:
+		ret = cb->image && cb->image(ob, walk_slice(w, &a, &node->slices[0]),
+			walk_slice(w, &b, &node->slices[1]), walk_slice(w, &c, &node->slices[2]), opaque);
+		break;
+
+	case SD_NODE_LINEBREAK:
+		ret = cb->linebreak && cb->linebreak(ob, opaque);
+		break;
+
+	case SD_NODE_LINK:
+		content = walk_children(w, node->children);
+		ret = cb->link && cb->link(ob, walk_slice(w, &a, &node->slices[0]),
+			walk_slice(w, &b, &node->slices[1]), content, opaque);
+		break;
+
+	case SD_NODE_RAW_HTML:
+		ret = cb->raw_html_tag && cb->raw_html_tag(ob, walk_slice(w, &a, &node->slices[0]), opaque);
+		break;
+
+	case SD_NODE_TRIPLE_EMPHASIS:
+		content = walk_children(w, node->children);
+		ret = cb->triple_emphasis && cb->triple_emphasis(ob, content, opaque);
+		break;
+
+	case SD_NODE_STRIKETHROUGH:
+		content = walk_children(w, node->children);
+		ret = cb->strikethrough && cb->strikethrough(ob, content, opaque);
+		break;
+
+	case SD_NODE_SUPERSCRIPT:
+		content = walk_children(w, node->children);
+		ret = cb->superscript && cb->superscript(ob, content, opaque);
+		break;
+
+	case SD_NODE_FOOTNOTE_REF:
+		ret = cb->footnote_ref && cb->footnote_ref(ob, node->flags, opaque);
+		break;
+
+	case SD_NODE_ENTITY:
+		if (cb->entity)
+			cb->entity(ob, walk_slice(w, &a, &node->slices[0]), opaque);
+		else if (walk_slice(w, &a, &node->slices[0]))
+			bufput(ob, a.data, a.size);
+		break;
+
+	case SD_NODE_TEXT:
+		walk_text(ob, w, &node->slices[0]);
+		break;
+
+	case SD_NODE_GROUP:
+		walk_nodes(ob, w, node->children);
+		break;
+	}
+
+	return ret;
+}
+
+static void
+walk_node(struct buf *ob, struct tree_walk *w, const struct sd_node *node)
+{
+	size_t depth = w->bufs.size;
+
+	if (!walk_callback(ob, w, node))
+		walk_text(ob, w, &node->source);
+
+	w->bufs.size = depth;
+}
+
+static void
+walk_nodes(struct buf *ob, struct tree_walk *w, const struct sd_node *node)
+{
+	for (; node; node = node->next)
+		walk_node(ob, w, node);
+}
+
+void
+sd_tree_render(struct buf *ob, const struct sd_tree *tree, const struct sd_callbacks *callbacks, void *opaque)
+{
+	struct tree_walk w;
+	size_t i;
+
+	w.tree = tree;
+	w.cb = callbacks;
+	w.opaque = opaque;
+	redcarpet_stack_init(&w.bufs, 8, tree->arena.allocator);
+
+	if (callbacks->doc_header)
+		callbacks->doc_header(ob, opaque);
+
+	walk_nodes(ob, &w, tree->nodes);
+
+	if (callbacks->doc_footer)
+		callbacks->doc_footer(ob, opaque);
+
+	for (i = 0; i < w.bufs.asize; ++i)
+		bufrelease(w.bufs.item[i]);
+	redcarpet_stack_free(&w.bufs);
+
+	bufcstr(ob);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2015, Vicent Marti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TREE_H__
+#define TREE_H__
+
+#include <stdint.h>
+#include "markdown.h"
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* sd_node_type - one per callback, plus the groups holding the header
+ * and body rows of a table */
+enum sd_node_type {
+	SD_NODE_BLOCKCODE,	/* slices: text, lang */
+	SD_NODE_BLOCKQUOTE,
+	SD_NODE_BLOCKHTML,	/* slices: text */
+	SD_NODE_HEADER,	/* flags: level */
+	SD_NODE_HRULE,
+	SD_NODE_LIST,	/* flags: list flags */
+	SD_NODE_LISTITEM,	/* flags: list flags */
+	SD_NODE_PARAGRAPH,
+	SD_NODE_TABLE,	/* children: two SD_NODE_GROUP */
+	SD_NODE_TABLE_ROW,
+	SD_NODE_TABLE_CELL,	/* flags: table flags */
+	SD_NODE_FOOTNOTES,
+	SD_NODE_FOOTNOTE_DEF,	/* flags: number */
+
+	SD_NODE_AUTOLINK,	/* slices: link; flags: enum mkd_autolink */
+	SD_NODE_CODESPAN,	/* slices: text */
+	SD_NODE_DOUBLE_EMPHASIS,
+	SD_NODE_EMPHASIS,
+	SD_NODE_UNDERLINE,
+	SD_NODE_HIGHLIGHT,
+	SD_NODE_QUOTE,	/* slices: text */
+	SD_NODE_IMAGE,	/* slices: link, title, alt */
+	SD_NODE_LINEBREAK,
+	SD_NODE_LINK,	/* slices: link, title */
+	SD_NODE_RAW_HTML,	/* slices: tag */
+	SD_NODE_TRIPLE_EMPHASIS,
+	SD_NODE_STRIKETHROUGH,
+	SD_NODE_SUPERSCRIPT,
+	SD_NODE_FOOTNOTE_REF,	/* flags: number */
+
+	SD_NODE_ENTITY,	/* slices: entity */
+	SD_NODE_TEXT,	/* slices: text */
+
+	SD_NODE_GROUP
+};
+
+#define SD_SLICE_NONE UINT32_MAX
+
+/* sd_slice - bytes of the tree's text; an offset past the end of the
+ * parsed document points into the bytes kept aside for text the parser
+ * built itself (unescaped links, code blocks without their indent...) */
+struct sd_slice {
+	uint32_t offset;	/* SD_SLICE_NONE when the callback got NULL */
+	uint32_t size;
+};
+
+struct sd_node {
+	struct sd_node *children;
+	struct sd_node *next;
+	uint8_t type;
+	unsigned int flags;
+	struct sd_slice slices[3];
+	struct sd_slice source;	/* the markup of a span, for renderers which skip it */
+};
+
+struct tree_walk;
+
+/* sd_tree - a document parsed by sd_markdown_parse */
+struct sd_tree {
+	struct sd_node *nodes;	/* top-level blocks */
+	uint8_t *text;	/* the document after the first pass */
+	size_t text_size;
+	struct buf *extra;
+	struct arena arena;	/* the nodes and the text */
+	unsigned int rewound;
+
+	/* while the tree is built: the renderer whose span callbacks decide
+	 * which spans the parser gets to keep */
+	const struct sd_callbacks *renderer;
+	void *renderer_opaque;
+	struct tree_walk *dry;
+};
+
+/* sd_tree_render • replays a tree into a set of callbacks, the same way
+ * the parser would have called them if they are those of the renderer
+ * the tree was parsed for (bar the calls whose output the parser threw
+ * away). The blocks and spans are those that renderer took, so other
+ * callbacks only get what parsing for them would give when they take
+ * the same ones; a span callback which is NULL or returns 0 gets the
+ * markup of the span printed verbatim */
+extern void
+sd_tree_render(struct buf *ob, const struct sd_tree *tree, const struct sd_callbacks *callbacks, void *opaque);
+
+extern void
+sd_tree_free(struct sd_tree *tree);
+
+/* used by the parser while it builds a tree */
+void redcarpet_tree_callbacks(struct sd_callbacks *, const struct sd_callbacks *);
+void redcarpet_tree_renderer(struct sd_tree *, const struct sd_callbacks *, void *);
+
+struct sd_tree *redcarpet_tree_new(const struct sd_allocator *);
+int redcarpet_tree_set_text(struct sd_tree *, const uint8_t *, size_t);
+struct sd_node *redcarpet_tree_nodes(struct sd_tree *, const struct buf *);
+void redcarpet_tree_rewind(struct sd_tree *, struct buf *, size_t);
+int redcarpet_tree_last_char(struct sd_tree *, const struct buf *);
+void redcarpet_tree_span(struct sd_tree *, struct buf *, const uint8_t *, size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,6 +6,14 @@ module Redcarpet
 
   class Markdown
     attr_reader :renderer
+
+    # Renders +text+ into +io+ (any object responding to +write+)
+    # chunk by chunk, without building the whole output as a single
+    # String first. Returns +io+.
+    def render_to(io, text)
+      render_chunks(text) { |chunk| io.write(chunk) }
+      io
+    end
   end
 
   module Render
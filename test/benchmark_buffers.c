@@ -0,0 +1,90 @@
+/*
+ * Reallocations and timings of the struct buf growth strategies.
+ *
+ * Run with `rake benchmark:buffers`, which builds this against buffer.c.
+ * Every case appends the same data to a BUF_GROW_UNIT and a BUF_GROW_DOUBLE
+ * buffer, the way the parser fills its work buffers and its output.
+ */
+
+#include "buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MEGABYTE (1024 * 1024)
+#define ROUNDS 3
+
+struct bench_case {
+	const char *name;
+	size_t unit;	/* unit of the buffer being filled */
+	size_t piece;	/* bytes appended by each bufput */
+	size_t total;	/* bytes appended in all */
+};
+
+static const struct bench_case cases[] = {
+	/* the block work buffer of a fenced code block, one line at a time */
+	{ "code block (4mb)", 256, 20, 4 * MEGABYTE },
+	/* the span work buffer of a list item, one line at a time */
+	{ "list item (4mb)", 64, 57, 4 * MEGABYTE },
+	/* the output buffer of Markdown#render, one paragraph at a time */
+	{ "paragraphs (8mb)", 128, 1160, 8 * MEGABYTE },
+};
+
+static char filler[2048];
+
+/* fill • appends a case's data to a new buffer, returning how many times
+ * the buffer was reallocated */
+static size_t
+fill(const struct bench_case *bc, bufgrowth_t growth)
+{
+	struct buf *ob = bufnew_growth(bc->unit, growth);
+	size_t done, asize = 0, reallocs = 0;
+
+	for (done = 0; done < bc->total; done += bc->piece) {
+		bufput(ob, filler, bc->piece);
+		if (ob->asize != asize) {
+			asize = ob->asize;
+			reallocs++;
+		}
+	}
+
+	bufrelease(ob);
+	return reallocs;
+}
+
+/* run • the reallocations of one fill and the time of ROUNDS of them */
+static double
+run(const struct bench_case *bc, bufgrowth_t growth, size_t *reallocs)
+{
+	clock_t start;
+	int i;
+
+	start = clock();
+	for (i = 0; i < ROUNDS; i++)
+		*reallocs = fill(bc, growth);
+
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int
+main(void)
+{
+	size_t i, unit_reallocs, double_reallocs;
+	double unit_time, double_time;
+
+	memset(filler, 'x', sizeof(filler));
+
+	printf("%-20s %15s %15s %10s %10s\n", "",
+		"unit reallocs", "double reallocs", "unit", "double");
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		unit_time = run(&cases[i], BUF_GROW_UNIT, &unit_reallocs);
+		double_time = run(&cases[i], BUF_GROW_DOUBLE, &double_reallocs);
+
+		printf("%-20s %15zu %15zu %9.3fs %9.3fs\n", cases[i].name,
+			unit_reallocs, double_reallocs, unit_time, double_time);
+	}
+
+	return 0;
+}
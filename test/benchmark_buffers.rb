@@ -0,0 +1,24 @@
+# coding: UTF-8
+# Rendering of large documents, which stresses buffer reallocation.
+#
+# Run with `rake benchmark:buffers`, which first counts the reallocations
+# of each buffer growth strategy with test/benchmark_buffers.c.
+require 'benchmark'
+require 'redcarpet'
+
+MEGABYTE = 1024 * 1024
+
+line = "Lorem ipsum dolor sit amet, consectetur adipiscing elit. "
+documents = {
+  "code block (4mb)" => "```\n" + ("x = 1 + 2 # comment\n" * (4 * MEGABYTE / 20)) + "```\n",
+  "list item (4mb)"  => "* " + (line * (4 * MEGABYTE / line.size)) + "\n",
+  "paragraphs (8mb)" => (line * 20 + "\n\n") * (8 * MEGABYTE / (line.size * 20 + 2)),
+}
+
+markdown = Redcarpet::Markdown.new(Redcarpet::Render::HTML, fenced_code_blocks: true)
+
+Benchmark.bm(20) do |bench|
+  documents.each do |name, text|
+    bench.report(name) { 3.times { markdown.render(text) } }
+  end
+end
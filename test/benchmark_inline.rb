@@ -0,0 +1,34 @@
+# coding: UTF-8
+# Inline parsing of prose, where most of the time goes into looking for
+# the next active character (emphasis, links, entities...).
+#
+# Run with `rake benchmark:inline`.
+require 'benchmark'
+require 'redcarpet'
+
+fixture = File.read(File.join(File.dirname(__FILE__), "fixtures/benchmark.md"))
+
+words = %w[the quick brown fox jumps over lazy dog parsing markdown into html
+           is mostly about reading plain sentences one after another until
+           something *interesting* shows up like a [link](http://example.com)]
+random = Random.new(42)
+paragraph = -> { Array.new(120) { words.sample(random: random) }.join(" ") + "\n\n" }
+prose = Array.new(2000) { paragraph.call }.join
+
+documents = {
+  "benchmark.md (x2000)" => [fixture, 2000],
+  "prose (#{prose.bytesize / 1024}kb, x20)" => [prose, 20],
+}
+
+parsers = {
+  "default"  => Redcarpet::Markdown.new(Redcarpet::Render::HTML),
+  "autolink" => Redcarpet::Markdown.new(Redcarpet::Render::HTML, autolink: true, strikethrough: true),
+}
+
+Benchmark.bm(32) do |bench|
+  documents.each do |name, (text, times)|
+    parsers.each do |kind, markdown|
+      bench.report("#{name} #{kind}") { times.times { markdown.render(text) } }
+    end
+  end
+end
@@ -0,0 +1,29 @@
+# coding: UTF-8
+# Documents with lots of reference-style links, like generated API
+# indexes, or lots of footnotes.
+#
+# Run with `rake benchmark:references`.
+require 'benchmark'
+require 'redcarpet'
+
+documents = [1_000, 10_000, 50_000].map do |count|
+  refs  = (1..count).map { |i| "[method #{i}]: /api/methods/#{i}.html \"Method #{i}\"\n" }.join
+  links = (1..count).map { |i| "* [method #{i}][Method #{i}]\n" }.join
+
+  ["#{count} references", refs + "\n" + links]
+end
+
+documents += [1_000, 10_000].map do |count|
+  text  = (1..count).map { |i| "Claim #{i}.[^#{i}]" }.join(" ")
+  notes = (1..count).map { |i| "[^#{i}]: See case #{i}.\n" }.join
+
+  ["#{count} footnotes", text + "\n\n" + notes]
+end
+
+markdown = Redcarpet::Markdown.new(Redcarpet::Render::HTML, footnotes: true)
+
+Benchmark.bm(20) do |bench|
+  documents.each do |name, text|
+    bench.report(name) { 3.times { markdown.render(text) } }
+  end
+end
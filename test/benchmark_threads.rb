@@ -0,0 +1,43 @@
+# coding: UTF-8
+# Throughput of large documents rendered with the :threads option, for
+# each thread count. Chunks referring to footnotes are rendered on the
+# calling thread once the others are done, so documents using them all
+# over don't get any faster.
+#
+# Run with `rake benchmark:threads`.
+require 'benchmark'
+require 'redcarpet'
+
+paragraph = "Some *emphasis*, a [link](http://example.com/) and `code` " * 12
+
+def document(paragraph, footnoted)
+  text = ""
+  while text.bytesize < 8 * 1024 * 1024
+    text << paragraph
+    text << "[^1]" if text.bytesize < footnoted
+    text << "\n\n"
+  end
+
+  text + "[^1]: The footnote.\n"
+end
+
+documents = [
+  ["plain (8mb)", document(paragraph, 0)],
+  ["footnotes in 1mb", document(paragraph, 1024 * 1024)],
+  ["footnotes in 8mb", document(paragraph, 8 * 1024 * 1024)]
+]
+
+counts = [1, 2, 4, 8]
+
+puts "%-22s" % "threads" + counts.map { |threads| "%12d" % threads }.join
+documents.each do |name, text|
+  rates = counts.map do |threads|
+    markdown = Redcarpet::Markdown.new(Redcarpet::Render::HTML, footnotes: true, threads: threads)
+    markdown.render(text)
+
+    time = Benchmark.realtime { 3.times { markdown.render(text) } }
+    "%8.1fmb/s" % (3 * text.bytesize / time / (1024 * 1024))
+  end
+
+  puts "%-22s" % name + rates.join
+end
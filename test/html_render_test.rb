@@ -182,6 +182,20 @@ class HTMLRenderTest < Redcarpet::TestCase
     assert_equal expected, output
   end
 
+  def test_footnotes_numbered_in_order_of_use
+    markers  = (1..2000).map { |i| "[^note#{2001 - i}]" }.join(" ")
+    notes    = (1..2000).map { |i| "[^note#{i}]: Note #{i}.\n" }.join
+    markdown = "Text #{markers} [^NOTE2000].\n\n#{notes}[^note1]: Ignored.\n"
+
+    output = render(markdown, with: [:footnotes])
+
+    assert output.start_with? '<p>Text <sup id="fnref1"><a href="#fn1">1</a></sup>'
+    assert output.include? "<li id=\"fn1\">\n<p>Note 2000.&nbsp;"
+    assert output.include? "<li id=\"fn2000\">\n<p>Note 1.&nbsp;"
+    assert_equal 2001, output.scan('<sup id=').size
+    refute output.include? "Ignored"
+  end
+
   def test_autolink_short_domains
     markdown = "Example of uri ftp://auto/short/domains. Email auto@l.n and link http://a/u/t/o/s/h/o/r/t"
     output   = render(markdown, with: [:autolink])
@@ -1,5 +1,6 @@
 # coding: UTF-8
 require 'test_helper'
+require 'stringio'
 
 class MarkdownTest < Redcarpet::TestCase
   def setup
@@ -296,6 +297,19 @@ class MarkdownTest < Redcarpet::TestCase
     assert out.include?("[1]: http://google.com")
   end
 
+  def test_that_fenced_code_is_closed_inside_a_quoted_list_item
+    text = <<-fenced.strip_heredoc
+      > - item
+      >     ~~~ruby
+      >     code
+      >     ~~~
+      >     - nested
+    fenced
+
+    html = render(text, with: [:fenced_code_blocks])
+    assert_match %r{<ul>\n<li>nested</li>\n</ul>}, html
+  end
+
   def test_that_fenced_code_copies_language_verbatim_with_braces
     text = "```{rust,no_run}\nx = 'foo'\n```"
     html = render(text, with: [:fenced_code_blocks])
@@ -408,6 +422,24 @@ class MarkdownTest < Redcarpet::TestCase
     assert_equal "<p><a href=\"http://google.es\">Link</a></p>", output
   end
 
+  def test_references_with_colliding_hashes
+    # both names have the same hash_link_ref value
+    output = render("[szdabpkyjp]: /one\n[cvltpzcnxn]: /two\n\n[a][szdabpkyjp] [b][cvltpzcnxn] [c][SZDABPKYJP]")
+
+    assert_equal "<p><a href=\"/one\">a</a> <a href=\"/two\">b</a> <a href=\"/one\">c</a></p>", output
+  end
+
+  def test_many_references
+    refs  = (1..3000).map { |i| "[ref #{i}]: /#{i}\n" }.join
+    links = (1..3000).map { |i| "[#{i}][Ref #{i}]" }.join(" ")
+
+    output = render(refs + "\n" + links)
+
+    assert_match %r{<a href="/1">1</a> <a href="/2">2</a>}, output
+    assert_match %r{<a href="/3000">3000</a></p>}, output
+    assert_equal 3000, output.scan("<a href").size
+  end
+
   def test_superscript
     output = render("this is the 2^nd time", with: [:superscript])
 
@@ -449,4 +481,261 @@ class MarkdownTest < Redcarpet::TestCase
 
     assert_match /<table>/, output
   end
+
+  def test_table_cells_with_and_without_markup
+    markdown = "| a | b | c |\n|---|---|---|\n| 1 > 0 | *em* |\n|  | `c` | \"q\" |\n"
+    expected = "<table><thead>\n<tr>\n<th>a</th>\n<th>b</th>\n<th>c</th>\n</tr>\n</thead><tbody>\n" \
+               "<tr>\n<td>1 &gt; 0</td>\n<td><em>em</em></td>\n<td></td>\n</tr>\n" \
+               "<tr>\n<td></td>\n<td><code>c</code></td>\n<td>&quot;q&quot;</td>\n</tr>\n</tbody></table>"
+
+    assert_equal expected, render(markdown, with: [:tables])
+  end
+
+  def test_active_characters_found_at_any_offset
+    (1..70).each do |n|
+      prose = "a" * n
+
+      assert_equal "<p>#{prose} <em>b</em> &amp; <code>c</code></p>", render("#{prose} *b* & `c`")
+    end
+  end
+
+  def test_render_leaves_the_source_untouched
+    markdown = "> a quote\n> on two lines\n\n* an item\n\n    with two\n    paragraphs\n* another\n".freeze
+    source   = markdown.dup
+
+    output = render(markdown)
+
+    assert_equal source, markdown
+    assert_match %r{<blockquote>\n<p>a quote\non two lines</p>}, output
+    assert_match %r{<li><p>an item</p>\n\n<p>with two\nparagraphs</p></li>}, output
+  end
+
+  def test_render_chunks_matches_render
+    markdown = "# Título\n\nSome *text* with ünïcödé.\n\n" * 2000
+    parser   = Redcarpet::Markdown.new(@renderer)
+    chunks   = parser.render_chunks(markdown)
+
+    assert_operator chunks.size, :>, 1
+    assert chunks.all?(&:valid_encoding?)
+    assert_equal parser.render(markdown), chunks.join
+
+    yielded = []
+    assert_equal parser, parser.render_chunks(markdown) { |chunk| yielded << chunk }
+    assert_equal chunks, yielded
+  end
+
+  def test_render_to_writes_into_io
+    markdown = "Hello *World*.\n\n" * 5000
+    parser   = Redcarpet::Markdown.new(@renderer)
+    io       = StringIO.new
+    writes   = 0
+
+    io.define_singleton_method(:write) { |*chunks| writes += 1; super(*chunks) }
+
+    assert_equal io, parser.render_to(io, markdown)
+    assert_equal parser.render(markdown), io.string
+    assert_operator writes, :>, 1
+  end
+
+  def test_render_stream_matches_render
+    markdown = "[ref]: http://example.com\n\n" +
+               "# Title\n\nSome *text* and a [link][ref].\n\n" \
+               "~~~\ncode\n\nmore code\n~~~\n\n<div>\n\nhtml\n\n</div>\n\n" * 2000
+    parser   = Redcarpet::Markdown.new(Redcarpet::Render::HTML.new, fenced_code_blocks: true)
+    output   = StringIO.new
+
+    parser.render_stream(StringIO.new(markdown), output)
+
+    assert_equal parser.render(markdown), output.string
+  end
+
+  def test_parsed_document_renders_like_the_renderer
+    markdown = "# Title\n\nSome *text*, a [link](http://example.com) and a note[^1].\n\n" \
+               "> * a quoted\n>   list\n\n    some code\n\n<div>html</div>\n\n[^1]: The note.\n"
+    parser   = Redcarpet::Markdown.new(Redcarpet::Render::HTML, footnotes: true)
+    document = parser.parse(markdown)
+
+    assert_equal parser.render(markdown), document.render(Redcarpet::Render::HTML)
+    assert_equal Redcarpet::Markdown.new(Redcarpet::Render::HTML.new(escape_html: true)).render("a <b>tag</b>"),
+                 parser.parse("a <b>tag</b>").render(Redcarpet::Render::HTML.new(escape_html: true))
+  end
+
+  def test_parsed_document_renders_like_a_subclass_of_the_renderer
+    anchored = Class.new(Redcarpet::Render::HTML) do
+      def header(text, level)
+        %(<h#{level} class="anchored">#{text}</h#{level}>\n)
+      end
+    end
+
+    markdown = "# A ^title \\: here\n\n> * a *quoted* ^list \\: item\n>\n>   ## with a header\n\n" \
+               "1. some ^(nested *spans*) \\* and `code`\n"
+
+    [Redcarpet::Render::HTML, Redcarpet::Render::HTML_TOC].each do |renderer|
+      parser = Redcarpet::Markdown.new(renderer, superscript: true)
+
+      assert_equal parser.render(markdown), parser.parse(markdown).render(renderer)
+    end
+
+    document = Redcarpet::Markdown.new(Redcarpet::Render::HTML, superscript: true).parse(markdown)
+
+    assert_equal Redcarpet::Markdown.new(anchored, superscript: true).render(markdown), document.render(anchored)
+  end
+
+  def test_parsed_document_leaves_declined_spans_to_the_parser
+    quotes = Redcarpet::Markdown.new(Redcarpet::Render::HTML, quote: true)
+    text   = "\" \"t\"\n"
+
+    assert_equal quotes.render(text), quotes.parse(text).render(Redcarpet::Render::HTML)
+
+    renderer = Redcarpet::Render::HTML.new(safe_links_only: true)
+    links    = Redcarpet::Markdown.new(renderer)
+
+    ["[*a*](javascript:x) [c](d)\n", "![a](javascript:x)\n"].each do |link|
+      assert_equal links.render(link), links.parse(link).render(renderer)
+    end
+  end
+
+  def test_render_cache
+    parser = Redcarpet::Markdown.new(Redcarpet::Render::HTML, cache_size: 1024)
+    output = parser.render("Some *text*")
+
+    assert_equal output, parser.render("Some *text*")
+    assert_equal "<p>Other <em>text</em></p>\n", parser.render("Other *text*")
+    assert_equal({ hits: 1, misses: 2, evictions: 0, entries: 2 }, parser.cache_stats.reject { |k, _| k == :bytes })
+
+    10.times { |i| parser.render("Paragraph #{i} " * 10) }
+
+    assert_operator parser.cache_stats[:evictions], :>, 0
+    assert_operator parser.cache_stats[:bytes], :<=, 1024
+    assert_nil Redcarpet::Markdown.new(Redcarpet::Render::HTML).cache_stats
+  end
+
+  def test_render_cache_of_empty_documents
+    parser = Redcarpet::Markdown.new(Redcarpet::Render::HTML, cache_size: 1024)
+
+    assert_equal "", parser.render("")
+    assert_equal "", parser.render("")
+    assert_equal 1, parser.cache_stats[:hits]
+  end
+
+  def test_work_budget
+    parser = Redcarpet::Markdown.new(Redcarpet::Render::HTML, work_budget: 20)
+
+    assert_equal "<p>Some <em>text</em></p>\n", parser.render("Some *text*")
+    refute parser.truncated?
+
+    assert_equal "<p>Some <em>text</em></p>\n\n<p>More &lt;b&gt;text&lt;/b&gt; *here*</p>\n",
+                 parser.render("Some *text*\n\nMore <b>text</b> *here*\n")
+    assert parser.truncated?
+
+    parser = Redcarpet::Markdown.new(Redcarpet::Render::HTML, work_budget: 1)
+
+    assert_equal "<p>a</p>\n", parser.render("a\n\n\n   ")
+    assert parser.truncated?
+  end
+
+  def test_max_nesting
+    parser = Redcarpet::Markdown.new(Redcarpet::Render::HTML, max_nesting: 1)
+
+    assert_equal "<blockquote>\n<blockquote>\n</blockquote>\n</blockquote>\n", parser.render("> > a *b*")
+    assert_raises(ArgumentError) { Redcarpet::Markdown.new(Redcarpet::Render::HTML, max_nesting: 0) }
+  end
+
+  def test_render_on_threads_matches_render
+    markdown = (1..5000).map { |i| "Paragraph #{i} with *text*#{"[^#{i % 3}]" if i % 500 == 0}.\n\n> a quote\n\n* a\n* list\n\n" }.join +
+               "[^0]: Zero.\n[^1]: One.\n[^2]: Two.\n"
+
+    expected = Redcarpet::Markdown.new(Redcarpet::Render::HTML, footnotes: true).render(markdown)
+    parser   = Redcarpet::Markdown.new(Redcarpet::Render::HTML, footnotes: true, threads: 4)
+
+    assert_equal expected, parser.render(markdown)
+  end
+
+  def test_render_from_several_threads
+    documents = (1..8).map { |i| "# Title #{i}\n\n" + "Some *text* and a [link](http://example.com).\n\n## Part\n\n" * 100 }
+    parser    = Redcarpet::Markdown.new(Redcarpet::Render::HTML_TOC)
+    expected  = documents.map { |markdown| Redcarpet::Markdown.new(Redcarpet::Render::HTML_TOC).render(markdown) }
+
+    threads = documents.map { |markdown| Thread.new { Array.new(10) { parser.render(markdown) } } }
+
+    threads.zip(expected).each do |thread, output|
+      assert_equal [output] * 10, thread.value
+    end
+  end
+
+  def test_render_while_streaming_from_another_thread
+    streamed = "# Title\n\nSome *text*.\n\n## Part\n\n" * 2000
+    rendered = "# Other\n\n## Section\n\n### Sub\n\n" * 20
+    parser   = Redcarpet::Markdown.new(Redcarpet::Render::HTML_TOC)
+    expected = [parser.render(streamed), parser.render(rendered)]
+
+    # every read lets the other thread render in the middle of the stream
+    input = StringIO.new(streamed)
+    def input.read(*args)
+      Thread.pass
+      super
+    end
+
+    output  = StringIO.new
+    stream  = Thread.new { parser.render_stream(input, output) }
+    renders = Thread.new { Array.new(50) { Thread.pass; parser.render(rendered) } }
+
+    stream.join
+    assert_equal expected[0], output.string
+    assert_equal [expected[1]] * 50, renders.value
+  end
+
+  def test_render_from_several_threads_with_ruby_callbacks
+    renderer = Class.new(Redcarpet::Render::HTML) do
+      def emphasis(text)
+        Thread.pass
+        "<em>#{text}</em>"
+      end
+    end
+
+    markdown = "Some *text* and a [link](http://example.com).\n\n* a *b*\n* c\n\n" * 50
+    parser   = Redcarpet::Markdown.new(renderer)
+    expected = Redcarpet::Markdown.new(renderer).render(markdown)
+
+    threads = Array.new(8) { Thread.new { Array.new(10) { parser.render(markdown) } } }
+
+    threads.each { |thread| assert_equal [expected] * 10, thread.value }
+  end
+
+  def test_render_after_a_callback_raised
+    renderer = Class.new(Redcarpet::Render::HTML) do
+      def emphasis(text)
+        raise ArgumentError, text if text == "boom"
+        "<em>#{text}</em>"
+      end
+    end
+
+    parser = Redcarpet::Markdown.new(renderer)
+
+    assert_raises(ArgumentError) { parser.render("* a *boom*\n\n> *b*\n") }
+    assert_raises(ArgumentError) { parser.parse("* a *boom*\n") }
+    assert_equal "<p><em>fine</em></p>\n", parser.render("*fine*")
+    assert_equal "<p><em>fine</em></p>\n", parser.render_incremental("*fine*")
+  end
+
+  def test_render_many_matches_render
+    documents = (1..20).map { |i| "# Title #{i}\n\nSome *text*[^#{i}].\n\n[^#{i}]: A note\n\n## Part\n" * i }
+
+    [Redcarpet::Render::HTML, Redcarpet::Render::HTML_TOC].each do |renderer|
+      parser = Redcarpet::Markdown.new(renderer, footnotes: true, threads: 4)
+
+      assert_equal documents.map { |markdown| parser.render(markdown) }, parser.render_many(documents)
+    end
+  end
+
+  def test_render_incremental_matches_render
+    parser   = Redcarpet::Markdown.new(Redcarpet::Render::HTML, tables: true, fenced_code_blocks: true)
+    markdown = "# Title\n\nSome *text*.\n\n* a\n* list\n\n```\ncode\n```\n\n| a | b |\n|---|---|\n| 1 | 2 |\n" * 50
+    edits    = [markdown, markdown.sub("Some", "Any"), markdown.sub("* list", "* list\n\nNow a paragraph"),
+                markdown.sub("```\ncode", "code"), markdown.sub("Title", "Title\n===="), "[a]: /x\n" + markdown]
+
+    edits.each do |text|
+      assert_equal parser.render(text), parser.render_incremental(text)
+    end
+  end
 end
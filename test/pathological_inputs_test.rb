@@ -19,16 +19,64 @@ class PathologicalInputsTest # < Redcarpet::TestCase
     @markdown.render("#{str*300}")
   end
 
-  def test_pathological_3
-    c = "`t`t`t`t`t`t" * 20000000
-    @markdown.render(c)
-  end
-
   def test_pathological_4
     @markdown.render(" [^a]: #{ "A" * 10000 }\n#{ "[^a][]" * 1000000 }\n")
   end
+end
+
+# Inputs which used to take quadratic time: rendering eight times more
+# of them must take about eight times longer, not sixty-four
+class LinearTimeTest < Redcarpet::TestCase
+  def setup
+    @markdown = Redcarpet::Markdown.new(Redcarpet::Render::HTML, strikethrough: true, highlight: true, lax_spacing: true)
+  end
+
+  def assert_linear(&input)
+    small, large = [2_000, 16_000].map do |n|
+      text = input.call(n)
+      Array.new(3) { elapsed { @markdown.render(text) } }.min
+    end
+
+    assert_operator large, :<, [small, 0.001].max * 24
+  end
+
+  def test_unclosed_emphasis
+    assert_linear { |n| "*a " * n }
+    assert_linear { |n| "**a _b " * n }
+    assert_linear { |n| "~~a ==b " * n }
+    assert_linear { |n| "*a [b] " * n }
+  end
+
+  def test_runs_of_emphasis_delimiters
+    assert_linear { |n| "#{'*' * n} hi #{'*' * n}" }
+  end
+
+  def test_code_spans
+    assert_linear { |n| "`t`t`t`t`t`t" * n }
+    assert_linear { |n| "`" * n + " a" }
+  end
+
+  def test_links
+    assert_linear { |n| ("[" * n) + "foo" + ("](bar)" * n) }
+    assert_linear { |n| ("[" * n) + "foo" + ("]" * n) }
+    assert_linear { |n| "[a " * n }
+    assert_linear { |n| "[a](" * n }
+    assert_linear { |n| "[a](b \"" * n }
+    assert_linear { |n| "[a][" * n }
+  end
+
+  def test_html_blocks
+    assert_linear { |n| "<div>\nfoo\n\n" * n }
+    assert_linear { |n| "text\n<div>\n" * n }
+    assert_linear { |n| "<div>\n  </div>\n\n" * n }
+    assert_linear { |n| "> <div>\n> </p>\n>\n" * n }
+  end
+
+  private
 
-  def test_unbound_recursion
-    @markdown.render(("[" * 10000) + "foo" + ("](bar)" * 10000))
+  def elapsed
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    yield
+    Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
   end
 end